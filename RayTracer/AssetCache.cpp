@@ -0,0 +1,243 @@
+#include "AssetCache.h"
+#include "ThreadPool.h"
+#include "TextureCache.h"
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+AssetCache& AssetCache::Global()
+{
+	// never destroyed, handles in other globals may be released after main returns
+	static AssetCache* cache = new AssetCache;
+	return *cache;
+}
+
+std::string AssetCache::CanonicalPath(const std::string& filepath)
+{
+#ifdef _WIN32
+	char buffer[_MAX_PATH];
+	if ( _fullpath(buffer, filepath.c_str(), _MAX_PATH) == nullptr )
+		return filepath;
+
+	// paths on windows are case insensitive and take either slash
+	std::string path = buffer;
+	for ( char& c : path )
+		c = c == '\\' ? '/' : (char)tolower(c);
+
+	return path;
+#else
+	char* resolved = realpath(filepath.c_str(), nullptr);
+	if ( resolved == nullptr )
+		return filepath;
+
+	std::string path = resolved;
+	free(resolved);
+
+	return path;
+#endif
+}
+
+static std::shared_ptr<const void> LoadSceneAsset(const std::string& filepath, unsigned int flags, size_t& outSize)
+{
+	std::shared_ptr<const Scene> scene = std::make_shared<const Scene>(filepath, (flags & AssetCache::SCENE_DISK_CACHE) != 0);
+
+	// the import failed, there is nothing to cache
+	if ( scene->NumMeshes() == 0 )
+		return nullptr;
+
+	outSize = scene->GetMemoryUsage();
+	return scene;
+}
+
+static std::shared_ptr<const void> LoadTextureAsset(const std::string& filepath, unsigned int flags, size_t& outSize)
+{
+	std::shared_ptr<Surface> texture;
+
+	if ( flags & AssetCache::TEXTURE_DISK_CACHE ) {
+		texture = TextureCache::Load(filepath);
+	}
+	else {
+		texture = std::make_shared<Surface>(filepath);
+		texture->GenerateMipMaps();
+	}
+
+	// couldn't decode the image, there is nothing to cache
+	if ( texture->GetPixels() == nullptr )
+		return nullptr;
+
+	if ( flags & AssetCache::TEXTURE_FLOAT_TEXELS )
+		texture->SetTexelFormat(Surface::TEXELS_FLOAT);
+	else if ( flags & AssetCache::TEXTURE_HALF_TEXELS )
+		texture->SetTexelFormat(Surface::TEXELS_HALF);
+
+	// GetMipMap returns the smallest level for anything past the end
+	outSize = 0;
+	const Surface* previous = nullptr;
+
+	for ( int level = 0; texture->GetMipMap(level) != previous; ++level ) {
+		previous = texture->GetMipMap(level);
+		outSize += previous->GetBufferSize() + previous->GetTexelBufferSize();
+	}
+
+	return texture;
+}
+
+AssetCache::SceneHandle AssetCache::LoadScene(const std::string& filepath, unsigned int flags)
+{
+	return std::static_pointer_cast<const Scene>(Load("scene", filepath, flags, LoadSceneAsset));
+}
+
+AssetCache::TextureHandle AssetCache::LoadTexture(const std::string& filepath, unsigned int flags)
+{
+	return std::static_pointer_cast<const Surface>(Load("texture", filepath, flags, LoadTextureAsset));
+}
+
+std::shared_future<AssetCache::SceneHandle> AssetCache::LoadSceneAsync(const std::string& filepath, unsigned int flags)
+{
+	return ThreadPool::Global().Submit([=]() { return LoadScene(filepath, flags); }).share();
+}
+
+std::shared_future<AssetCache::TextureHandle> AssetCache::LoadTextureAsync(const std::string& filepath, unsigned int flags)
+{
+	return ThreadPool::Global().Submit([=]() { return LoadTexture(filepath, flags); }).share();
+}
+
+std::shared_ptr<const void> AssetCache::Load(const char* type, const std::string& filepath, unsigned int flags, Loader loader)
+{
+	std::string canonicalPath = CanonicalPath(filepath);
+	std::string key = std::string(type) + ":" + std::to_string(flags) + ":" + canonicalPath;
+
+	std::promise<std::shared_ptr<const void>> promise;
+	std::shared_future<std::shared_ptr<const void>> pending;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		auto found = entries.find(key);
+		if ( found != entries.end() ) {
+
+			found->second.lastUse = ++useCounter;
+			pending = found->second.asset;
+		}
+		else {
+
+			Entry& entry = entries[key];
+			entry.asset = promise.get_future().share();
+			entry.lastUse = ++useCounter;
+		}
+	}
+
+	// someone else is loading it or already has, wait outside of the lock
+	if ( pending.valid() )
+		return MakeHandle(pending.get());
+
+	size_t size = 0;
+	std::shared_ptr<const void> asset;
+
+	try {
+		asset = loader(canonicalPath, flags, size);
+	}
+	catch ( ... ) {
+
+		// the ones waiting get the exception, and a later load tries again
+		promise.set_exception(std::current_exception());
+
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.erase(key);
+		throw;
+	}
+
+	promise.set_value(asset);
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// a failed load isn't kept, the file may be fixed by the next try
+	if ( asset == nullptr ) {
+		entries.erase(key);
+		return asset;
+	}
+
+	Entry& entry = entries[key];
+	entry.size = size;
+	entry.loaded = true;
+	memoryUsage += size;
+
+	if ( memoryBudget != 0 )
+		Evict(memoryBudget);
+
+	return MakeHandle(asset);
+}
+
+std::shared_ptr<const void> AssetCache::MakeHandle(const std::shared_ptr<const void>& asset)
+{
+	if ( asset == nullptr )
+		return nullptr;
+
+	// the handle holds the asset, and once its last copy is gone the
+	// asset may be the one that has to go to get back under the budget
+	std::shared_ptr<const void> held = asset;
+
+	return std::shared_ptr<const void>(asset.get(), [this, held](const void*) mutable {
+		held.reset();
+		Released();
+	});
+}
+
+void AssetCache::Released()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if ( memoryBudget != 0 )
+		Evict(memoryBudget);
+}
+
+void AssetCache::Evict(size_t budget)
+{
+	if ( memoryUsage <= budget )
+		return;
+
+	std::vector<std::pair<unsigned long long, std::string>> candidates;
+
+	for ( const auto& entry : entries ) {
+
+		// still loading, or someone holds a handle
+		if ( !entry.second.loaded || entry.second.asset.get().use_count() > 1 )
+			continue;
+
+		candidates.push_back({ entry.second.lastUse, entry.first });
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+
+	for ( const auto& candidate : candidates ) {
+
+		if ( memoryUsage <= budget )
+			break;
+
+		memoryUsage -= entries[candidate.second].size;
+		entries.erase(candidate.second);
+	}
+}
+
+void AssetCache::SetMemoryBudget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	memoryBudget = bytes;
+
+	if ( memoryBudget != 0 )
+		Evict(memoryBudget);
+}
+
+size_t AssetCache::GetMemoryUsage() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return memoryUsage;
+}
+
+void AssetCache::EvictUnused()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	Evict(0);
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include "Importing.h"
+#include "Surface.h"
+
+#include <memory>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Shares loaded scenes and textures between everything that uses them.
+// Assets are keyed by their canonical path and load flags, so the same
+// file reached through different relative paths is only loaded once.
+// Handles are immutable and reference counted, and an asset stays in
+// the cache while anyone holds a handle to it. Handles must not outlive
+// the cache they came from, the global one is never destroyed.
+//
+// If several threads ask for an asset that isn't loaded yet, one of them
+// loads it and the others wait for that load instead of starting their own.
+
+class AssetCache
+{
+public:
+	typedef std::shared_ptr<const Scene> SceneHandle;
+	typedef std::shared_ptr<const Surface> TextureHandle;
+
+	enum SceneFlags {
+		// read and write the scene's .rtmesh cache file
+		SCENE_DISK_CACHE = 1
+	};
+
+	// textures always come with their whole mip chain
+	enum TextureFlags {
+		// read and write the texture's .rttex cache file
+		TEXTURE_DISK_CACHE = 1,
+
+		// keep converted texels for faster sampling, see Surface::SetTexelFormat
+		TEXTURE_FLOAT_TEXELS = 2,
+		TEXTURE_HALF_TEXELS = 4
+	};
+
+private:
+	struct Entry {
+
+		std::shared_future<std::shared_ptr<const void>> asset;
+
+		// loading entries can't be evicted, others are waiting for them
+		bool loaded = false;
+		size_t size = 0;
+		unsigned long long lastUse = 0;
+
+	};
+
+	std::unordered_map<std::string, Entry> entries;
+	mutable std::mutex mutex;
+
+	size_t memoryBudget = 0;
+	size_t memoryUsage = 0;
+	unsigned long long useCounter = 0;
+
+	typedef std::shared_ptr<const void> (*Loader)(const std::string& filepath, unsigned int flags, size_t& outSize);
+
+	std::shared_ptr<const void> Load(const char* type, const std::string& filepath, unsigned int flags, Loader loader);
+
+	// wraps a loaded asset so the cache hears when the last copy is released
+	std::shared_ptr<const void> MakeHandle(const std::shared_ptr<const void>& asset);
+	void Released();
+
+	// drops the least recently used assets nobody holds until usage
+	// is within the budget. Called with the mutex held.
+	void Evict(size_t budget);
+
+public:
+	static AssetCache& Global();
+
+	static std::string CanonicalPath(const std::string& filepath);
+
+	// null if the scene couldn't be imported, which isn't cached
+	SceneHandle LoadScene(const std::string& filepath, unsigned int flags = SCENE_DISK_CACHE);
+
+	// null if the image couldn't be decoded, which isn't cached
+	TextureHandle LoadTexture(const std::string& filepath, unsigned int flags = TEXTURE_DISK_CACHE);
+
+	// start loading on the thread pool and return right away, so
+	// several assets can load at once while the caller does other work
+	std::shared_future<SceneHandle> LoadSceneAsync(const std::string& filepath, unsigned int flags = SCENE_DISK_CACHE);
+	std::shared_future<TextureHandle> LoadTextureAsync(const std::string& filepath, unsigned int flags = TEXTURE_DISK_CACHE);
+
+	// once the loaded assets use more than this many bytes, the ones
+	// nobody holds are dropped, oldest first. Checked after every load
+	// and whenever the last handle to an asset is released. 0 means no limit
+	void SetMemoryBudget(size_t bytes);
+	size_t GetMemoryUsage() const;
+
+	// drops every asset nobody holds
+	void EvictUnused();
+
+};
@@ -0,0 +1,243 @@
+#include "Benchmarks.h"
+#include "Sampling.h"
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <cmath>
+
+#define CACHE_LINE_SIZE 64
+#define CACHE_SETS 64
+#define CACHE_WAYS 8
+
+// bilinear lookups per cluster, and how far from the
+// center of the cluster they land, in texels
+#define TAPS_PER_CLUSTER 32
+#define CLUSTER_RADIUS 3
+
+// the footprint's reference is the average of this
+// many bilinear lookups in a grid on each side
+#define REFERENCE_GRID 16
+
+namespace Benchmarks {
+
+	// set associative cache with least recently used replacement,
+	// only the tags are kept
+	class SimulatedCache {
+
+	private:
+		long long tags[CACHE_SETS][CACHE_WAYS];
+		long long lastUse[CACHE_SETS][CACHE_WAYS];
+		long long clock = 0;
+
+	public:
+		long long hits = 0;
+		long long misses = 0;
+
+		SimulatedCache()
+		{
+			for ( int s = 0; s < CACHE_SETS; ++s ) {
+				for ( int w = 0; w < CACHE_WAYS; ++w ) {
+					tags[s][w] = -1;
+					lastUse[s][w] = 0;
+				}
+			}
+		}
+
+		void Access(long long address)
+		{
+			long long line = address / CACHE_LINE_SIZE;
+			int set = (int)(line % CACHE_SETS);
+
+			int oldest = 0;
+			++clock;
+
+			for ( int w = 0; w < CACHE_WAYS; ++w ) {
+
+				if ( tags[set][w] == line ) {
+					lastUse[set][w] = clock;
+					++hits;
+					return;
+				}
+
+				if ( lastUse[set][w] < lastUse[set][oldest] )
+					oldest = w;
+			}
+
+			tags[set][oldest] = line;
+			lastUse[set][oldest] = clock;
+			++misses;
+		}
+
+	};
+
+	struct Tap {
+		int x;
+		int y;
+	};
+
+	static void SampleLayout(const Surface& texture, const std::vector<Tap>& taps, const char* name)
+	{
+		int maxX = texture.GetWidth() - 1;
+		int maxY = texture.GetHeight() - 1;
+
+		// addresses are relative to the start of the buffer, which
+		// is assumed to start on a cache line
+		SimulatedCache cache;
+
+		int bytesPerTexel = sizeof(int);
+		if ( texture.GetTexelFormat() != Surface::TEXELS_PACKED )
+			bytesPerTexel = texture.GetTexelBufferSize() / (texture.GetBufferSize() / sizeof(int));
+
+		for ( const Tap& tap : taps ) {
+
+			int x2 = std::min(tap.x + 1, maxX);
+			int y2 = std::min(tap.y + 1, maxY);
+
+			cache.Access((long long)texture.PixelIndex(tap.x, tap.y) * bytesPerTexel);
+			cache.Access((long long)texture.PixelIndex(x2, tap.y) * bytesPerTexel);
+			cache.Access((long long)texture.PixelIndex(tap.x, y2) * bytesPerTexel);
+			cache.Access((long long)texture.PixelIndex(x2, y2) * bytesPerTexel);
+		}
+
+		Vec4 sum;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for ( const Tap& tap : taps ) {
+
+			int x2 = std::min(tap.x + 1, maxX);
+			int y2 = std::min(tap.y + 1, maxY);
+
+			sum += texture.GetPixel(tap.x, tap.y);
+			sum += texture.GetPixel(x2, tap.y);
+			sum += texture.GetPixel(tap.x, y2);
+			sum += texture.GetPixel(x2, y2);
+		}
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// the sum is printed so the loop can't be optimized away
+		std::cout << name << ": " << seconds * 1e9 / taps.size() << " ns per lookup, "
+			<< 100.0 * cache.hits / (cache.hits + cache.misses) << "% simulated L1 hits "
+			<< "(checksum " << sum.r + sum.g + sum.b << ")" << std::endl;
+	}
+
+	void SampleLayouts(const Surface& texture, int numClusters)
+	{
+		std::vector<Tap> taps;
+		taps.reserve((size_t)numClusters * TAPS_PER_CLUSTER);
+
+		for ( int c = 0; c < numClusters; ++c ) {
+
+			Sampler sampler(c, 0, 0);
+
+			int centerX = (int)(sampler.Next() * texture.GetWidth());
+			int centerY = (int)(sampler.Next() * texture.GetHeight());
+
+			for ( int t = 0; t < TAPS_PER_CLUSTER; ++t ) {
+
+				int x = centerX + (int)((sampler.Next() * 2 - 1) * CLUSTER_RADIUS);
+				int y = centerY + (int)((sampler.Next() * 2 - 1) * CLUSTER_RADIUS);
+
+				taps.push_back({ std::max(0, std::min(x, texture.GetWidth() - 1)), std::max(0, std::min(y, texture.GetHeight() - 1)) });
+			}
+		}
+
+		Surface linear(texture);
+		linear.SetTexelFormat(Surface::TEXELS_PACKED);
+		linear.SetLayout(Surface::LAYOUT_LINEAR);
+
+		Surface tiled(texture);
+		tiled.SetTexelFormat(Surface::TEXELS_PACKED);
+		tiled.SetLayout(Surface::LAYOUT_TILED);
+
+		std::cout << "Sampling " << texture.GetWidth() << "x" << texture.GetHeight() << " texture, "
+			<< taps.size() << " bilinear lookups" << std::endl;
+
+		SampleLayout(linear, taps, "Linear");
+		SampleLayout(tiled, taps, "Tiled 4x4");
+
+		tiled.SetTexelFormat(Surface::TEXELS_HALF);
+		SampleLayout(tiled, taps, "Tiled 4x4, half texels");
+
+		tiled.SetTexelFormat(Surface::TEXELS_FLOAT);
+		SampleLayout(tiled, taps, "Tiled 4x4, float texels");
+	}
+
+	// the error of one way of estimating the average over each footprint
+	template <class Estimate>
+	static void FilterFootprint(const std::vector<Vec2>& centers, const std::vector<Vec4>& references, const char* name, Estimate estimate)
+	{
+		std::vector<Vec4> estimates(centers.size());
+
+		auto start = std::chrono::steady_clock::now();
+
+		for ( size_t i = 0; i < centers.size(); ++i )
+			estimates[i] = estimate(centers[i], (int)i);
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		double squaredError = 0;
+		for ( size_t i = 0; i < centers.size(); ++i ) {
+			Vec4 difference = estimates[i] - references[i];
+			squaredError += difference.r * difference.r + difference.g * difference.g + difference.b * difference.b;
+		}
+
+		std::cout << name << ": " << seconds * 1e9 / centers.size() << " ns per estimate, "
+			<< sqrt(squaredError / (3 * centers.size())) << " RMS error" << std::endl;
+	}
+
+	void FilterFootprints(const Surface& texture, int numLookups, float footprintTexels)
+	{
+		// footprints are measured in texture coordinates, like ConeFootprint returns
+		float footprint = footprintTexels / std::max(texture.GetWidth(), texture.GetHeight());
+
+		std::vector<Vec2> centers(numLookups);
+		std::vector<Vec4> references(numLookups);
+
+		for ( int i = 0; i < numLookups; ++i ) {
+
+			Sampler sampler(i, 0, 0);
+			centers[i] = sampler.Next2D();
+
+			Vec4 sum;
+			for ( int y = 0; y < REFERENCE_GRID; ++y ) {
+				for ( int x = 0; x < REFERENCE_GRID; ++x ) {
+					Vec2 offset((x + 0.5f) / REFERENCE_GRID - 0.5f, (y + 0.5f) / REFERENCE_GRID - 0.5f);
+					sum += SampleTexture(texture, centers[i] + offset * footprint, 0);
+				}
+			}
+
+			references[i] = sum / (REFERENCE_GRID * REFERENCE_GRID);
+		}
+
+		std::cout << "Filtering " << footprintTexels << " texel footprints on a " << texture.GetWidth() << "x" << texture.GetHeight()
+			<< " texture, " << numLookups << " estimates" << std::endl;
+
+		FilterFootprint(centers, references, "1 bilinear lookup", [&](const Vec2& center, int i) {
+			return SampleTexture(texture, center, 0);
+		});
+
+		for ( int numSamples = 4; numSamples <= 16; numSamples *= 2 ) {
+
+			std::string name = std::to_string(numSamples) + " jittered bilinear lookups";
+
+			FilterFootprint(centers, references, name.c_str(), [&](const Vec2& center, int i) {
+
+				Sampler sampler(i, 1, numSamples);
+
+				Vec4 sum;
+				for ( int s = 0; s < numSamples; ++s )
+					sum += SampleTexture(texture, center + (sampler.Next2D() - Vec2(0.5f, 0.5f)) * footprint, 0);
+
+				return sum / (float)numSamples;
+			});
+		}
+
+		FilterFootprint(centers, references, "1 trilinear lookup", [&](const Vec2& center, int i) {
+			return SampleTexture(texture, center, footprint);
+		});
+	}
+
+}
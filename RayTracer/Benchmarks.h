@@ -0,0 +1,21 @@
+#pragma once
+#include "Surface.h"
+
+// Microbenchmarks for the texture paths. Each one prints its own results.
+
+namespace Benchmarks {
+
+	// samples the texture in small clusters of nearby texels at random
+	// places, the pattern incoherent reflection rays produce, once in
+	// each Surface layout and texel format. Prints the time per bilinear
+	// lookup and the hit rate of a simulated 32KB, 8 way L1 cache for each.
+	void SampleLayouts(const Surface& texture, int numClusters);
+
+	// compares ways of sampling a footprint footprintTexels wide at random
+	// places on the texture: one bilinear lookup, several jittered bilinear
+	// lookups averaged, and one trilinear lookup of the mip chain picked by
+	// the footprint. Prints the time per estimate and the RMS error against
+	// a dense average of the footprint. The mip maps have to have been generated
+	void FilterFootprints(const Surface& texture, int numLookups, float footprintTexels);
+
+}
@@ -0,0 +1,559 @@
+#include "Distributed.h"
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+
+typedef SOCKET SocketHandle;
+#define POLL WSAPoll
+#define SEND_FLAGS 0
+
+#else
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+typedef int SocketHandle;
+#define INVALID_SOCKET -1
+#define closesocket close
+#define POLL poll
+
+// writing to a dead worker should fail, not raise SIGPIPE
+#define SEND_FLAGS MSG_NOSIGNAL
+
+#endif
+
+#define PROTOCOL_VERSION 1
+
+// tiles a worker may hold at once, so it has the next one
+// queued while it sends back the last
+#define TILES_IN_FLIGHT 2
+
+// milliseconds the coordinator waits on sockets between scheduling passes
+#define POLL_INTERVAL 50
+
+// longest scene name a worker can send in its hello
+#define MAX_SCENE_NAME 256
+
+// most bytes read from a worker in one go
+#define RECV_CHUNK 65536
+
+namespace Distributed {
+
+	enum MessageType {
+		MSG_HELLO,
+		MSG_TILE,
+		MSG_RESULT,
+		MSG_DONE
+	};
+
+	struct MessageHeader {
+		unsigned int type;
+		unsigned int size;
+	};
+
+	struct TileMessage {
+		int tileId;
+		int displayWidth;
+		int displayHeight;
+		int x;
+		int y;
+		int width;
+		int height;
+	};
+
+	struct ResultHeader {
+		int tileId;
+		int width;
+		int height;
+	};
+
+	static bool InitSockets()
+	{
+#ifdef _WIN32
+		static bool initialized = false;
+		if ( !initialized ) {
+			WSADATA data;
+			initialized = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		}
+		return initialized;
+#else
+		return true;
+#endif
+	}
+
+	static bool SendAll(SocketHandle s, const void* data, size_t size)
+	{
+		const char* p = (const char*)data;
+		while ( size > 0 ) {
+			int sent = send(s, p, (int)size, SEND_FLAGS);
+			if ( sent <= 0 )
+				return false;
+			p += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	static bool RecvAll(SocketHandle s, void* data, size_t size)
+	{
+		char* p = (char*)data;
+		while ( size > 0 ) {
+			int received = recv(s, p, (int)size, 0);
+			if ( received <= 0 )
+				return false;
+			p += received;
+			size -= received;
+		}
+		return true;
+	}
+
+	static bool SendMessage(SocketHandle s, MessageType type, const void* payload, unsigned int size)
+	{
+		MessageHeader header = { (unsigned int)type, size };
+		return SendAll(s, &header, sizeof(header)) && (size == 0 || SendAll(s, payload, size));
+	}
+
+	static void SetNoDelay(SocketHandle s)
+	{
+		// tiles are sent as soon as they are written, don't let them sit in the buffer
+		int flag = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag));
+	}
+
+	/////// COORDINATOR ////////
+
+	Coordinator::Coordinator(int port, int tileSize, float tileTimeoutSeconds, float giveUpSeconds, const std::string& bindAddress)
+		:
+		port(port), tileSize(tileSize), tileTimeout(tileTimeoutSeconds), giveUpTimeout(giveUpSeconds), bindAddress(bindAddress)
+	{
+	}
+
+	bool Coordinator::Render(Surface& target, const std::string& sceneName, TileProgress* progress)
+	{
+		typedef std::chrono::steady_clock Clock;
+
+		if ( !InitSockets() || tileSize <= 0 )
+			return false;
+
+		SocketHandle listener = socket(AF_INET, SOCK_STREAM, 0);
+		if ( listener == INVALID_SOCKET )
+			return false;
+
+		int reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+
+		if ( inet_pton(AF_INET, bindAddress.c_str(), &address.sin_addr) != 1 ) {
+			std::cout << "Coordinator can't bind to " << bindAddress << ", it isn't an IPv4 address" << std::endl;
+			closesocket(listener);
+			return false;
+		}
+
+		if ( bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0 ) {
+			std::cout << "Coordinator could not listen on port " << port << std::endl;
+			closesocket(listener);
+			return false;
+		}
+
+		struct Tile {
+			TileMessage message;
+			bool done;
+			int holders;
+			Clock::time_point assigned;
+		};
+
+		struct Worker {
+			SocketHandle socket;
+			bool ready;
+			std::vector<int> tiles;
+
+			// what arrived of a message that isn't complete yet,
+			// and when the last bytes came in
+			std::vector<char> received;
+			Clock::time_point lastReceived;
+		};
+
+		// split the target into tiles
+		std::vector<Tile> tiles;
+		for ( int y = 0; y < target.GetHeight(); y += tileSize ) {
+			for ( int x = 0; x < target.GetWidth(); x += tileSize ) {
+
+				Tile tile = {};
+				tile.message.tileId = (int)tiles.size();
+				tile.message.displayWidth = target.GetWidth();
+				tile.message.displayHeight = target.GetHeight();
+				tile.message.x = x;
+				tile.message.y = y;
+				tile.message.width = std::min(tileSize, target.GetWidth() - x);
+				tile.message.height = std::min(tileSize, target.GetHeight() - y);
+
+				tiles.push_back(tile);
+			}
+		}
+
+		std::vector<Worker> workers;
+
+		int tilesLeft = (int)tiles.size();
+		int nextTile = 0;
+
+		// the last time a tile came back, or the start of the frame
+		Clock::time_point lastFinished = Clock::now();
+
+		auto dropWorker = [&](int w) {
+
+			// anything it was holding has to be rendered by someone else
+			for ( int t : workers[w].tiles ) {
+				tiles[t].holders--;
+				if ( !tiles[t].done && tiles[t].holders == 0 && t < nextTile )
+					nextTile = t;
+			}
+
+			std::cout << "Worker " << w << " lost with " << workers[w].tiles.size() << " tiles" << std::endl;
+
+			closesocket(workers[w].socket);
+			workers.erase(workers.begin() + w);
+		};
+
+		auto assignTile = [&](Worker& worker, int t) -> bool {
+
+			if ( !SendMessage(worker.socket, MSG_TILE, &tiles[t].message, sizeof(TileMessage)) )
+				return false;
+
+			tiles[t].holders++;
+			tiles[t].assigned = Clock::now();
+			worker.tiles.push_back(t);
+			return true;
+		};
+
+		// the largest payload each message may have, anything bigger
+		// is dropped before waiting for all of it to arrive
+		auto messageLimit = [&](unsigned int type) -> size_t {
+
+			if ( type == MSG_HELLO )
+				return sizeof(int) + MAX_SCENE_NAME;
+			if ( type == MSG_RESULT )
+				return sizeof(ResultHeader) + (size_t)tileSize * tileSize * sizeof(int);
+			return 0;
+		};
+
+		// returns false if the worker sent something it shouldn't have
+		auto handleMessage = [&](int w, const MessageHeader& header, const char* payload) -> bool {
+
+			Worker& worker = workers[w];
+
+			if ( header.type == MSG_HELLO ) {
+
+				// the version, then the name
+				if ( header.size < sizeof(int) ) {
+					std::cout << "Rejecting worker with a hello of " << header.size << " bytes" << std::endl;
+					return false;
+				}
+
+				int version;
+				memcpy(&version, payload, sizeof(int));
+				std::string scene(payload + sizeof(int), header.size - sizeof(int));
+
+				if ( version != PROTOCOL_VERSION || scene != sceneName ) {
+					std::cout << "Rejecting worker rendering " << scene << std::endl;
+					return false;
+				}
+
+				worker.ready = true;
+				return true;
+			}
+
+			if ( header.type != MSG_RESULT || header.size < sizeof(ResultHeader) )
+				return false;
+
+			ResultHeader result;
+			memcpy(&result, payload, sizeof(result));
+
+			// only take back a tile this worker was given, in the size it was given
+			auto held = std::find(worker.tiles.begin(), worker.tiles.end(), result.tileId);
+
+			if ( result.tileId < 0 || result.tileId >= (int)tiles.size() || held == worker.tiles.end() ||
+				result.width != tiles[result.tileId].message.width || result.height != tiles[result.tileId].message.height ||
+				header.size != sizeof(result) + (size_t)result.width * result.height * sizeof(int) )
+			{
+				std::cout << "Worker " << w << " sent a result for a tile it doesn't hold" << std::endl;
+				return false;
+			}
+
+			worker.tiles.erase(held);
+
+			Tile& tile = tiles[result.tileId];
+			tile.holders--;
+
+			// a tile that was duplicated may come back twice, only the first counts
+			if ( !tile.done ) {
+
+				const char* pixels = payload + sizeof(result);
+
+				for ( int y = 0; y < tile.message.height; ++y ) {
+					for ( int x = 0; x < tile.message.width; ++x ) {
+
+						int pixel;
+						memcpy(&pixel, pixels + (y * tile.message.width + x) * sizeof(int), sizeof(int));
+						target.PutPixel(tile.message.x + x, tile.message.y + y, pixel);
+					}
+				}
+
+				if ( progress != nullptr )
+					progress->MarkRect(tile.message.x, tile.message.y, tile.message.width, tile.message.height);
+
+				tile.done = true;
+				tilesLeft--;
+				lastFinished = Clock::now();
+			}
+
+			return true;
+		};
+
+		while ( tilesLeft > 0 ) {
+
+			Clock::time_point now = Clock::now();
+
+			// every worker died or hung, and nobody came to take over
+			if ( std::chrono::duration<float>(now - lastFinished).count() > giveUpTimeout ) {
+				std::cout << "Coordinator gave up, no tile came back in " << giveUpTimeout << " seconds" << std::endl;
+				break;
+			}
+
+			// wait on the listener and every worker
+			std::vector<pollfd> fds(workers.size() + 1);
+
+			fds[0].fd = listener;
+			fds[0].events = POLLIN;
+			for ( size_t w = 0; w < workers.size(); ++w ) {
+				fds[w + 1].fd = workers[w].socket;
+				fds[w + 1].events = POLLIN;
+			}
+
+			POLL(fds.data(), (unsigned int)fds.size(), POLL_INTERVAL);
+
+			if ( fds[0].revents & POLLIN ) {
+
+				SocketHandle s = accept(listener, nullptr, nullptr);
+				if ( s != INVALID_SOCKET ) {
+					SetNoDelay(s);
+					workers.push_back({ s, false, {}, {}, Clock::now() });
+				}
+			}
+
+			// read from workers in reverse so dropping one doesn't shift the rest
+			for ( int w = (int)fds.size() - 2; w >= 0; --w ) {
+
+				Worker& worker = workers[w];
+
+				if ( !(fds[w + 1].revents & (POLLIN | POLLERR | POLLHUP)) ) {
+
+					// a worker that stops in the middle of a message
+					// would otherwise keep its tiles until the give up
+					if ( !worker.received.empty() &&
+						std::chrono::duration<float>(Clock::now() - worker.lastReceived).count() > tileTimeout )
+					{
+						std::cout << "Worker " << w << " stalled in the middle of a message" << std::endl;
+						dropWorker(w);
+					}
+
+					continue;
+				}
+
+				// poll said there is something to read, so this doesn't block.
+				// Messages are handled once all of them has arrived
+				size_t had = worker.received.size();
+				worker.received.resize(had + RECV_CHUNK);
+
+				int received = recv(worker.socket, worker.received.data() + had, RECV_CHUNK, 0);
+				if ( received <= 0 ) {
+					dropWorker(w);
+					continue;
+				}
+
+				worker.received.resize(had + received);
+				worker.lastReceived = Clock::now();
+
+				size_t used = 0;
+				bool valid = true;
+
+				while ( valid && worker.received.size() - used >= sizeof(MessageHeader) ) {
+
+					MessageHeader header;
+					memcpy(&header, worker.received.data() + used, sizeof(header));
+
+					if ( header.size > messageLimit(header.type) ) {
+						std::cout << "Worker " << w << " sent a message of " << header.size << " bytes" << std::endl;
+						valid = false;
+						break;
+					}
+
+					if ( worker.received.size() - used - sizeof(header) < header.size )
+						break;
+
+					valid = handleMessage(w, header, worker.received.data() + used + sizeof(header));
+					used += sizeof(header) + header.size;
+				}
+
+				if ( !valid ) {
+					dropWorker(w);
+					continue;
+				}
+
+				worker.received.erase(worker.received.begin(), worker.received.begin() + used);
+			}
+
+			// hand out tiles to workers with room for more
+			for ( int w = (int)workers.size() - 1; w >= 0; --w ) {
+
+				Worker& worker = workers[w];
+				if ( !worker.ready )
+					continue;
+
+				while ( worker.tiles.size() < TILES_IN_FLIGHT ) {
+
+					// first choice is a tile nobody has
+					while ( nextTile < (int)tiles.size() && (tiles[nextTile].done || tiles[nextTile].holders > 0) )
+						nextTile++;
+
+					int t = nextTile < (int)tiles.size() ? nextTile : -1;
+
+					// otherwise duplicate the tile that has been out the longest,
+					// if it has been out too long
+					if ( t == -1 && worker.tiles.empty() ) {
+
+						Clock::time_point now = Clock::now();
+						float oldest = tileTimeout;
+
+						for ( int i = 0; i < (int)tiles.size(); ++i ) {
+
+							float age = std::chrono::duration<float>(now - tiles[i].assigned).count();
+
+							if ( !tiles[i].done && tiles[i].holders > 0 && age > oldest ) {
+								oldest = age;
+								t = i;
+							}
+						}
+					}
+
+					if ( t == -1 )
+						break;
+
+					if ( !assignTile(worker, t) ) {
+						dropWorker(w);
+						break;
+					}
+				}
+			}
+		}
+
+		// tell the workers the frame is finished
+		for ( Worker& worker : workers ) {
+			SendMessage(worker.socket, MSG_DONE, nullptr, 0);
+			closesocket(worker.socket);
+		}
+
+		closesocket(listener);
+		return tilesLeft == 0;
+	}
+
+	/////// WORKER ////////
+
+	bool RunWorker(const std::string& host, int port, const std::string& sceneName, Renderer& renderer,
+		Renderer::RayGenerationShader pRayGen, Renderer::MissShader pMissShader)
+	{
+		if ( !InitSockets() )
+			return false;
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* info = nullptr;
+		if ( getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &info) != 0 )
+			return false;
+
+		SocketHandle s = socket(AF_INET, SOCK_STREAM, 0);
+
+		// the coordinator may not be listening yet
+		bool connected = false;
+		for ( int attempt = 0; attempt < 100 && !connected; ++attempt ) {
+
+			connected = connect(s, info->ai_addr, (int)info->ai_addrlen) == 0;
+
+			if ( !connected )
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		freeaddrinfo(info);
+
+		if ( !connected ) {
+			std::cout << "Worker could not connect to " << host << ":" << port << std::endl;
+			closesocket(s);
+			return false;
+		}
+
+		SetNoDelay(s);
+
+		std::vector<char> hello(sizeof(int) + sceneName.size());
+		*(int*)hello.data() = PROTOCOL_VERSION;
+		memcpy(hello.data() + sizeof(int), sceneName.data(), sceneName.size());
+
+		if ( !SendMessage(s, MSG_HELLO, hello.data(), (unsigned int)hello.size()) ) {
+			closesocket(s);
+			return false;
+		}
+
+		Surface tileSurface(1, 1);
+		bool finished = false;
+
+		while ( true ) {
+
+			MessageHeader header;
+			if ( !RecvAll(s, &header, sizeof(header)) )
+				break;
+
+			if ( header.type == MSG_DONE ) {
+				finished = true;
+				break;
+			}
+
+			TileMessage tile;
+			if ( header.type != MSG_TILE || !RecvAll(s, &tile, sizeof(tile)) )
+				break;
+
+			tileSurface.Resize(tile.width, tile.height, false);
+			renderer.RenderRegion(&tileSurface, tile.displayWidth, tile.displayHeight, tile.x, tile.y, pRayGen, pMissShader);
+
+			// the pixels follow the result header in the same message
+			ResultHeader result = { tile.tileId, tile.width, tile.height };
+			unsigned int pixelBytes = tile.width * tile.height * sizeof(int);
+
+			MessageHeader resultHeader = { MSG_RESULT, (unsigned int)sizeof(result) + pixelBytes };
+
+			if ( !SendAll(s, &resultHeader, sizeof(resultHeader)) || !SendAll(s, &result, sizeof(result)) ||
+				!SendAll(s, tileSurface.GetPixels(), pixelBytes) )
+				break;
+		}
+
+		closesocket(s);
+		return finished;
+	}
+
+}
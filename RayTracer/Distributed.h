@@ -0,0 +1,51 @@
+#pragma once
+#include "Renderer.h"
+#include "Surface.h"
+#include <string>
+
+// Splits a frame into tiles and renders them in worker processes.
+//
+// The coordinator listens on a TCP port, workers that have loaded the same
+// scene connect to it and are handed tiles. Each finished tile is sent back
+// as soon as it is done. Tiles held by a worker that disconnects are handed
+// to another worker, and once nothing is left to hand out, tiles that have
+// been out longer than the timeout are duplicated on idle workers so a slow
+// worker can't hold up the frame. Messages are read as they arrive and
+// only handled once complete, so a worker that stops halfway through one
+// can't block the coordinator, and is dropped after the tile timeout.
+//
+// Messages from workers are checked, but nothing authenticates them, so the
+// coordinator only listens on the loopback interface unless told otherwise.
+
+namespace Distributed {
+
+	class Coordinator {
+
+	private:
+		int port;
+		int tileSize;
+		float tileTimeout;
+		float giveUpTimeout;
+		std::string bindAddress;
+
+	public:
+		// the frame is abandoned once no tile came back for giveUpSeconds, which
+		// is also how long the first worker has to connect. bindAddress is the
+		// IPv4 address of the interface to listen on, "0.0.0.0" takes workers
+		// from any machine on the network
+		Coordinator(int port, int tileSize, float tileTimeoutSeconds, float giveUpSeconds, const std::string& bindAddress = "127.0.0.1");
+
+		// blocks until every tile of the target has been rendered, only workers
+		// that report the same scene name are given tiles. Tiles are marked
+		// in progress as they arrive, if it isn't null. Returns false if
+		// the frame was abandoned
+		bool Render(Surface& target, const std::string& sceneName, TileProgress* progress = nullptr);
+
+	};
+
+	// connects to a coordinator and renders the tiles it hands out with the
+	// scene already added to the renderer, returns once the frame is finished
+	bool RunWorker(const std::string& host, int port, const std::string& sceneName, Renderer& renderer,
+		Renderer::RayGenerationShader pRayGen, Renderer::MissShader pMissShader);
+
+}
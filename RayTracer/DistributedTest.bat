@@ -0,0 +1,47 @@
+@echo off
+rem Renders the cow scene in one process, then again with a coordinator
+rem and several worker processes on this machine, and checks that both
+rem images are the same. Run it from this directory so the scene and
+rem textures are found.
+rem
+rem     DistributedTest.bat [path to RayTracer.exe] [number of workers]
+
+setlocal
+
+set EXE=%~1
+if "%EXE%"=="" set EXE=..\x64\Release\RayTracer.exe
+
+set WORKERS=%~2
+if "%WORKERS%"=="" set WORKERS=3
+
+set PORT=5600
+set SINGLE=distributed_single.bmp
+set TILED=distributed_tiled.bmp
+
+del /q %SINGLE% %TILED% 2> nul
+
+echo Rendering in one process
+"%EXE%" --render %SINGLE%
+if errorlevel 1 goto failed
+
+rem the workers retry until the coordinator is listening,
+rem and exit on their own once the frame is finished
+echo Rendering with %WORKERS% workers
+for /L %%i in (1, 1, %WORKERS%) do start "worker %%i" /B "%EXE%" --worker %PORT%
+
+"%EXE%" --coordinator %PORT% %TILED%
+if errorlevel 1 goto failed
+
+fc /b %SINGLE% %TILED% > nul
+if errorlevel 1 goto different
+
+echo PASSED
+exit /b 0
+
+:different
+echo FAILED, the images are different
+exit /b 1
+
+:failed
+echo FAILED, a render didn't finish
+exit /b 1
@@ -0,0 +1,352 @@
+#include "EnvironmentMap.h"
+#include "Sampling.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <math.h>
+
+#define ENVIRONMENT_CACHE_VERSION 1
+
+// every face starts on a boundary of this many bytes
+#define ENVIRONMENT_CACHE_ALIGNMENT 64
+
+// size of the faces of level 1, each level after it is half as large
+#define PREFILTER_SIZE 256
+#define PREFILTER_MIN_SIZE 8
+
+// lobe samples per filtered texel, and texels per task
+#define PREFILTER_SAMPLES 64
+#define PREFILTER_GRAIN 256
+
+const char* const EnvironmentMap::CACHE_EXTENSION = ".rtenv";
+
+struct EnvironmentHeader {
+
+	char magic[4];
+	unsigned int version;
+
+	// the faces the levels were filtered from
+	unsigned long long sourceHash;
+
+	unsigned int numLevels;
+	unsigned int firstLevelSize;
+
+};
+
+static int LevelSize(int sourceSize, int level)
+{
+	int size = (sourceSize < PREFILTER_SIZE ? sourceSize : PREFILTER_SIZE) >> (level - 1);
+	return size < PREFILTER_MIN_SIZE ? PREFILTER_MIN_SIZE : size;
+}
+
+// where each filtered face starts in the cache, in the order
+// level 1 faces +x to -z, level 2 faces +x to -z, and so on
+static unsigned long long FaceOffset(int sourceSize, int level, int face)
+{
+	unsigned long long offset = sizeof(EnvironmentHeader);
+
+	for ( int l = 1; l <= level; ++l ) {
+		for ( int f = 0; f < 6; ++f ) {
+
+			offset = (offset + ENVIRONMENT_CACHE_ALIGNMENT - 1) / ENVIRONMENT_CACHE_ALIGNMENT * ENVIRONMENT_CACHE_ALIGNMENT;
+
+			if ( l == level && f == face )
+				return offset;
+
+			unsigned long long size = LevelSize(sourceSize, l);
+			offset += size * size * sizeof(int);
+		}
+	}
+
+	return offset;
+}
+
+static unsigned long long HashFaces(const Surface* const planes[6])
+{
+	// FNV-1a over the sizes and pixels of every face
+	unsigned long long hash = 14695981039346656037ull;
+
+	auto mix = [&hash](const unsigned char* bytes, size_t size) {
+		for ( size_t i = 0; i < size; ++i ) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	};
+
+	for ( int f = 0; f < 6; ++f ) {
+
+		int dimensions[3] = { planes[f]->GetWidth(), planes[f]->GetHeight(), planes[f]->GetLayout() };
+		mix((const unsigned char*)dimensions, sizeof(dimensions));
+		mix((const unsigned char*)planes[f]->GetPixels(), planes[f]->GetBufferSize());
+	}
+
+	return hash;
+}
+
+static float RadicalInverse(unsigned int bits)
+{
+	// Van der Corput sequence, the second coordinate of the Hammersley points
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return bits * 2.3283064365386963e-10f;
+}
+
+static Vec4 FilterLobe(const Surface* const source[6], const Vec3& normal, float alpha)
+{
+	// GGX importance sampling with the view direction along the normal, "Real Shading in Unreal Engine 4", Karis.
+	// Each sample reads the mip level whose texels cover the solid angle the sample stands for,
+	// "GPU-Based Importance Sampling", Colbert and Krivanek, so few samples are enough
+
+	Vec3 up = fabs(normal.z) < 0.999f ? Vec3(0, 0, 1) : Vec3(1, 0, 0);
+	Vec3 tangentX = (up % normal).Normalized();
+	Vec3 tangentY = normal % tangentX;
+
+	float alpha2 = alpha * alpha;
+
+	Vec4 sum(0, 0, 0, 0);
+	float sumWeights = 0;
+
+	for ( int i = 0; i < PREFILTER_SAMPLES; ++i ) {
+
+		float phi = 2 * (float)PI * (i + 0.5f) / PREFILTER_SAMPLES;
+		float u = RadicalInverse(i);
+
+		float cosTheta = sqrtf((1 - u) / (1 + (alpha2 - 1) * u));
+		float sinTheta = sqrtf(1 - cosTheta * cosTheta);
+
+		Vec3 halfway = tangentX * (sinTheta * cosf(phi)) + tangentY * (sinTheta * sinf(phi)) + normal * cosTheta;
+		Vec3 light = halfway * (2 * (normal * halfway)) - normal;
+
+		float nDotL = normal * light;
+		if ( nDotL <= 0 )
+			continue;
+
+		// the pdf of the light direction is D / 4 when the view is the normal
+		float denominator = cosTheta * cosTheta * (alpha2 - 1) + 1;
+		float pdf = alpha2 / ((float)PI * denominator * denominator) / 4;
+
+		float sampleSolidAngle = 1 / (PREFILTER_SAMPLES * pdf);
+
+		sum += SampleCubeMap(source, light, sqrtf(sampleSolidAngle)) * nDotL;
+		sumWeights += nDotL;
+	}
+
+	if ( sumWeights == 0 )
+		return SampleCubeMap(source, normal);
+
+	return sum / sumWeights;
+}
+
+// a texel of a face, texels past the edges are
+// read from the face that continues there
+static Vec4 FetchTexel(const Surface* const planes[6], int face, int x, int y)
+{
+	const Surface* surface = planes[face];
+
+	if ( x >= 0 && x < surface->GetWidth() && y >= 0 && y < surface->GetHeight() )
+		return surface->GetPixel(x, y);
+
+	Vec2 center((x + 0.5f) / surface->GetWidth(), (y + 0.5f) / surface->GetHeight());
+
+	Vec2 faceTexel;
+	surface = planes[CubeMapFace(CubeMapDirection(face, center), faceTexel)];
+
+	int neighborX = (int)(faceTexel.s * surface->GetWidth());
+	int neighborY = (int)(faceTexel.t * surface->GetHeight());
+
+	neighborX = neighborX < 0 ? 0 : neighborX >= surface->GetWidth() ? surface->GetWidth() - 1 : neighborX;
+	neighborY = neighborY < 0 ? 0 : neighborY >= surface->GetHeight() ? surface->GetHeight() - 1 : neighborY;
+
+	return surface->GetPixel(neighborX, neighborY);
+}
+
+static Vec4 SeamlessSample(const Surface* const planes[6], const Vec3& dir)
+{
+	Vec2 faceTexel;
+	int face = CubeMapFace(dir, faceTexel);
+
+	// texel location minus half a pixel in x and y
+	float x = faceTexel.s * planes[face]->GetWidth() - 0.5f;
+	float y = faceTexel.t * planes[face]->GetHeight() - 0.5f;
+
+	int i = (int)floorf(x);
+	int j = (int)floorf(y);
+
+	float alpha = x - i;
+	float beta = y - j;
+
+	Vec4 c1 = FetchTexel(planes, face, i, j);
+	Vec4 c2 = FetchTexel(planes, face, i + 1, j);
+	Vec4 c3 = FetchTexel(planes, face, i, j + 1);
+	Vec4 c4 = FetchTexel(planes, face, i + 1, j + 1);
+
+	return c1 * (1 - alpha) * (1 - beta) +
+		c2 * alpha * (1 - beta) +
+		c3 * (1 - alpha) * beta +
+		c4 * alpha * beta;
+}
+
+EnvironmentMap::EnvironmentMap(const std::shared_ptr<const Surface> faces[6], const std::string& cachePath)
+{
+	for ( int f = 0; f < 6; ++f ) {
+		this->faces[0][f] = faces[f];
+		planes[0][f] = faces[f].get();
+	}
+
+	unsigned long long sourceHash = HashFaces(planes[0]);
+	std::string path = cachePath.empty() ? "" : cachePath + CACHE_EXTENSION;
+
+	if ( !path.empty() && MapCache(path, sourceHash) )
+		return;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for ( int level = 1; level < NUM_LEVELS; ++level )
+		Prefilter(level);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Prefiltered environment map in " << seconds << " seconds" << std::endl;
+
+	if ( !path.empty() )
+		WriteCache(path, sourceHash);
+}
+
+void EnvironmentMap::Prefilter(int level)
+{
+	int size = LevelSize(planes[0][0]->GetWidth(), level);
+
+	// the lobe of level NUM_LEVELS - 1 is roughness 1
+	float roughness = (float)level / (NUM_LEVELS - 1);
+	float alpha = roughness * roughness;
+
+	std::shared_ptr<Surface> levelFaces[6];
+	for ( int f = 0; f < 6; ++f )
+		levelFaces[f] = std::make_shared<Surface>(size, size);
+
+	const Surface* const* source = planes[0];
+
+	ThreadPool::Global().ParallelFor(6 * size * size, PREFILTER_GRAIN, [&](int begin, int end) {
+
+		for ( int i = begin; i < end; ++i ) {
+
+			int face = i / (size * size);
+			int x = i % size;
+			int y = i / size % size;
+
+			Vec3 normal = CubeMapDirection(face, { (x + 0.5f) / size, (y + 0.5f) / size }).Normalized();
+			levelFaces[face]->PutPixel(x, y, FilterLobe(source, normal, alpha));
+		}
+
+	});
+
+	for ( int f = 0; f < 6; ++f ) {
+		faces[level][f] = levelFaces[f];
+		planes[level][f] = levelFaces[f].get();
+	}
+}
+
+bool EnvironmentMap::MapCache(const std::string& cachePath, unsigned long long sourceHash)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(cachePath, true);
+	if ( !file->IsOpen() || file->GetSize() < sizeof(EnvironmentHeader) )
+		return false;
+
+	EnvironmentHeader header;
+	memcpy(&header, file->GetData(), sizeof(header));
+
+	int sourceSize = planes[0][0]->GetWidth();
+
+	if ( memcmp(header.magic, "RTEN", 4) != 0 || header.version != ENVIRONMENT_CACHE_VERSION || header.sourceHash != sourceHash ||
+		header.numLevels != NUM_LEVELS || header.firstLevelSize != (unsigned int)LevelSize(sourceSize, 1) ) {
+		return false;
+	}
+
+	// the offset past the last face is where one more level would start
+	if ( file->GetSize() < FaceOffset(sourceSize, NUM_LEVELS, 0) )
+		return false;
+
+	for ( int level = 1; level < NUM_LEVELS; ++level ) {
+		for ( int f = 0; f < 6; ++f ) {
+
+			int size = LevelSize(sourceSize, level);
+			int* pPixels = (int*)(file->GetWritableData() + FaceOffset(sourceSize, level, f));
+
+			faces[level][f] = std::make_shared<Surface>(size, size, pPixels, file);
+			planes[level][f] = faces[level][f].get();
+		}
+	}
+
+	return true;
+}
+
+void EnvironmentMap::WriteCache(const std::string& cachePath, unsigned long long sourceHash) const
+{
+	int sourceSize = planes[0][0]->GetWidth();
+
+	EnvironmentHeader header = {};
+	memcpy(header.magic, "RTEN", 4);
+	header.version = ENVIRONMENT_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	header.numLevels = NUM_LEVELS;
+	header.firstLevelSize = LevelSize(sourceSize, 1);
+
+	// other processes may have the old cache mapped, it is replaced once the new one is complete
+	bool written = MappedFile::WriteFileAtomically(cachePath, [&](std::ofstream& file) {
+
+		file.write((const char*)&header, sizeof(header));
+
+		static const char zeros[ENVIRONMENT_CACHE_ALIGNMENT] = {};
+
+		for ( int level = 1; level < NUM_LEVELS; ++level ) {
+			for ( int f = 0; f < 6; ++f ) {
+
+				unsigned long long position = file.tellp();
+				file.write(zeros, FaceOffset(sourceSize, level, f) - position);
+				file.write((const char*)planes[level][f]->GetPixels(), planes[level][f]->GetBufferSize());
+			}
+		}
+
+	});
+
+	if ( !written )
+		std::cout << "Could not write environment map cache " << cachePath << std::endl;
+}
+
+Vec4 EnvironmentMap::Sample(const Vec3& dir, float roughness) const
+{
+	roughness = roughness < 0 ? 0 : roughness > 1 ? 1 : roughness;
+
+	float level = roughness * (NUM_LEVELS - 1);
+	int lower = (int)level;
+
+	if ( lower >= NUM_LEVELS - 1 )
+		return SeamlessSample(planes[NUM_LEVELS - 1], dir);
+
+	return Vec4::Lerp(SeamlessSample(planes[lower], dir), SeamlessSample(planes[lower + 1], dir), level - lower);
+}
+
+Vec4 EnvironmentMap::SampleCone(const Vec3& dir, float coneSpread) const
+{
+	coneSpread = fabs(coneSpread);
+
+	// reflected directions of a GGX lobe spread over about 2 alpha radians,
+	// and alpha is the roughness squared. A cone narrower than the lobe of
+	// level 1, like a camera ray's, picks a mip level of the cube map itself
+	// by its width instead of blurring in the prefiltered levels
+	float firstRoughness = 1.0f / (NUM_LEVELS - 1);
+	if ( coneSpread < 2 * firstRoughness * firstRoughness )
+		return SampleCubeMap(planes[0], dir, coneSpread);
+
+	return Sample(dir, sqrtf(coneSpread / 2));
+}
+
+const Surface* const* EnvironmentMap::GetLevel(int level) const
+{
+	return planes[level];
+}
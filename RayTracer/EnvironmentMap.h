@@ -0,0 +1,54 @@
+#pragma once
+#include "Surface.h"
+#include "Vec3.h"
+#include "Vec4.h"
+#include <memory>
+#include <string>
+
+// A cube map with a chain of prefiltered levels for glossy reflections.
+// Level 0 is the cube map itself, every level after it is the cube map
+// convolved with the GGX lobe of a rougher surface, at a lower resolution.
+// A glossy reflection is then one filtered lookup instead of many rays.
+//
+// Lookups filter across the edges of the faces, so blurry levels don't
+// show the seams of the cube.
+
+class EnvironmentMap
+{
+public:
+	static constexpr int NUM_LEVELS = 6;
+
+	// filtered levels are stored at this path with this appended
+	static const char* const CACHE_EXTENSION;
+
+private:
+	// level 0 are the faces that were passed in
+	std::shared_ptr<const Surface> faces[NUM_LEVELS][6];
+	const Surface* planes[NUM_LEVELS][6];
+
+	bool MapCache(const std::string& cachePath, unsigned long long sourceHash);
+	void WriteCache(const std::string& cachePath, unsigned long long sourceHash) const;
+
+	void Prefilter(int level);
+
+public:
+	// faces are in the order +x, -x, +y, -y, +z, -z and need their mip maps,
+	// the filtering samples them. If cachePath isn't empty the filtered levels
+	// are read from cachePath + CACHE_EXTENSION when it was made from the same
+	// faces, otherwise they are filtered on the thread pool and written there
+	EnvironmentMap(const std::shared_ptr<const Surface> faces[6], const std::string& cachePath = "");
+
+	EnvironmentMap(const EnvironmentMap&) = delete;
+	EnvironmentMap& operator=(const EnvironmentMap&) = delete;
+
+	// roughness from 0, a mirror, to 1, blended between the two closest levels
+	Vec4 Sample(const Vec3& dir, float roughness) const;
+
+	// the level whose lobe is as wide as the ray's cone. Cones narrower
+	// than the lobe of level 1 are a trilinear lookup in the mip maps of
+	// level 0 instead
+	Vec4 SampleCone(const Vec3& dir, float coneSpread) const;
+
+	const Surface* const* GetLevel(int level) const;
+
+};
@@ -0,0 +1,158 @@
+#include "EnvironmentSampler.h"
+#include "ThreadPool.h"
+#include <math.h>
+
+// texels per face side the table is built from
+#define SAMPLER_SIZE 256
+
+#define SAMPLER_GRAIN 4096
+
+EnvironmentSampler::EnvironmentSampler(const Surface* const planes[6])
+{
+	// the same mip level of every face, so all the texels are the same size
+	int level = 0;
+	while ( planes[0]->GetMipMap(level)->GetWidth() > SAMPLER_SIZE && planes[0]->GetMipMap(level + 1) != planes[0]->GetMipMap(level) )
+		++level;
+
+	const Surface* faces[6];
+	for ( int f = 0; f < 6; ++f )
+		faces[f] = planes[f]->GetMipMap(level);
+
+	faceSize = faces[0]->GetWidth();
+
+	int numTexels = 6 * faceSize * faceSize;
+	texels.resize(numTexels);
+
+	std::vector<float> weights(numTexels);
+
+	ThreadPool::Global().ParallelFor(numTexels, SAMPLER_GRAIN, [&](int begin, int end) {
+
+		for ( int i = begin; i < end; ++i ) {
+
+			int f = i / (faceSize * faceSize);
+			int x = i % faceSize;
+			int y = i / faceSize % faceSize;
+
+			// faces may be smaller than the first one, read the matching texel
+			const Surface* face = faces[f];
+			Vec4 color = face->GetPixel(x * face->GetWidth() / faceSize, y * face->GetHeight() / faceSize);
+
+			Vec3 dir = CubeMapDirection(f, { (x + 0.5f) / faceSize, (y + 0.5f) / faceSize });
+
+			// the solid angle of a texel of a face 2 units wide at distance 1
+			float distance2 = dir * dir;
+			float solidAngle = (4.0f / (faceSize * faceSize)) / (distance2 * sqrtf(distance2));
+
+			float luminance = 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+			weights[i] = luminance * solidAngle;
+		}
+
+	});
+
+	double sumWeights = 0;
+	for ( float weight : weights )
+		sumWeights += weight;
+
+	// a black environment is sampled uniformly
+	if ( sumWeights <= 0 ) {
+
+		sumWeights = 0;
+		for ( int i = 0; i < numTexels; ++i ) {
+
+			Vec3 dir = CubeMapDirection(i / (faceSize * faceSize), { (i % faceSize + 0.5f) / faceSize, (i / faceSize % faceSize + 0.5f) / faceSize });
+			float distance2 = dir * dir;
+
+			weights[i] = 1 / (distance2 * sqrtf(distance2));
+			sumWeights += weights[i];
+		}
+	}
+
+	// texels are faceSize / 2 texels per unit on their faces
+	float texelArea = 4.0f / (faceSize * faceSize);
+
+	// scale the weights so they average 1, then split them into the texels
+	// below the average and above it. Each small texel is topped up to 1 by
+	// a large one, which becomes its alias
+	std::vector<int> small, large;
+
+	for ( int i = 0; i < numTexels; ++i ) {
+
+		texels[i].density = (float)(weights[i] / sumWeights) / texelArea;
+
+		weights[i] = (float)(weights[i] * numTexels / sumWeights);
+		(weights[i] < 1 ? small : large).push_back(i);
+	}
+
+	while ( !small.empty() && !large.empty() ) {
+
+		int s = small.back();
+		small.pop_back();
+
+		int l = large.back();
+
+		texels[s].probability = weights[s];
+		texels[s].alias = l;
+
+		weights[l] -= 1 - weights[s];
+
+		if ( weights[l] < 1 ) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// whatever is left is 1 up to rounding
+	for ( int i : small ) {
+		texels[i].probability = 1;
+		texels[i].alias = i;
+	}
+
+	for ( int i : large ) {
+		texels[i].probability = 1;
+		texels[i].alias = i;
+	}
+}
+
+float EnvironmentSampler::Density(const Vec3& dir, int texel) const
+{
+	// uniform over the texel's area on the face, and a small area dA
+	// at distance d covers a solid angle of dA cos / d^2 = dA / d^3
+	float distance2 = dir * dir;
+	return texels[texel].density * distance2 * sqrtf(distance2);
+}
+
+Vec3 EnvironmentSampler::Sample(Sampler& sampler, float& outPdf) const
+{
+	// the column and the coin between it and its alias need their own
+	// dimensions, the fraction left after picking one of hundreds of
+	// thousands of columns from one float is far too coarse for the coin
+	int texel = (int)(((unsigned long long)sampler.NextUInt() * texels.size()) >> 32);
+
+	if ( sampler.Next() >= texels[texel].probability )
+		texel = texels[texel].alias;
+
+	int face = texel / (faceSize * faceSize);
+	int x = texel % faceSize;
+	int y = texel / faceSize % faceSize;
+
+	Vec2 offset = sampler.Next2D();
+	Vec3 dir = CubeMapDirection(face, { (x + offset.s) / faceSize, (y + offset.t) / faceSize });
+
+	outPdf = Density(dir, texel);
+	return dir.Normalized();
+}
+
+float EnvironmentSampler::Pdf(const Vec3& dir) const
+{
+	Vec2 faceTexel;
+	int face = CubeMapFace(dir, faceTexel);
+
+	int x = (int)(faceTexel.s * faceSize);
+	int y = (int)(faceTexel.t * faceSize);
+
+	x = x < 0 ? 0 : x >= faceSize ? faceSize - 1 : x;
+	y = y < 0 ? 0 : y >= faceSize ? faceSize - 1 : y;
+
+	// the point on the face, which is what the density is for
+	return Density(CubeMapDirection(face, faceTexel), face * faceSize * faceSize + y * faceSize + x);
+}
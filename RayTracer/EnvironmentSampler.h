@@ -0,0 +1,45 @@
+#pragma once
+#include "Surface.h"
+#include "Sampling.h"
+#include "Vec3.h"
+#include <vector>
+
+// Picks directions toward a cube map in proportion to how much light
+// comes from them, so rays toward the environment aren't wasted on dim
+// sky. Every texel gets a weight of its luminance times its solid angle,
+// and an alias table over the weights picks a texel in constant time.
+// "A Linear Algorithm for Generating Random Numbers with a Given Distribution", Vose
+
+class EnvironmentSampler
+{
+private:
+	struct Texel {
+
+		// chance to keep this texel, otherwise alias is taken
+		float probability;
+		int alias;
+
+		// chance of picking this texel divided by its area on the face
+		float density;
+
+	};
+
+	std::vector<Texel> texels;
+	int faceSize;
+
+	// the density for dir on a face texel, in solid angle
+	float Density(const Vec3& dir, int texel) const;
+
+public:
+	// planes are in the order +x, -x, +y, -y, +z, -z and need their mip
+	// maps, the table is built from the largest level at most 256 texels wide
+	EnvironmentSampler(const Surface* const planes[6]);
+
+	// a normalized direction toward the environment, and the pdf
+	// of picking it with respect to solid angle. Uses 4 dimensions
+	Vec3 Sample(Sampler& sampler, float& outPdf) const;
+
+	// the pdf Sample has for dir, for combining with other strategies
+	float Pdf(const Vec3& dir) const;
+
+};
@@ -3,229 +3,809 @@
 #include <assimp/postprocess.h>
 
 #include "Importing.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "ObjLoader.h"
+#include "PlyLoader.h"
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <climits>
+
+#define IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_JoinIdenticalVertices)
+
+#define CACHE_VERSION 3
+
+// every array in the cache starts on a boundary of this many bytes
+#define CACHE_ALIGNMENT 64
+
+const char* const Scene::CACHE_EXTENSION = ".rtmesh";
+
+enum CacheStreams {
+	STREAM_INDICES,
+	STREAM_POSITIONS,
+	STREAM_NORMALS,
+	STREAM_TEXTURE_COORDS,
+	STREAM_COLORS,
+	STREAM_TANGENTS,
+	STREAM_BITANGENTS,
+	NUM_STREAMS
+};
+
+struct CacheHeader {
+
+	char magic[4];
+	unsigned int version;
+
+	// the source file the cache was made from, if either of
+	// these changes the cache is out of date
+	long long sourceSize;
+	long long sourceTime;
+
+	unsigned int importFlags;
+	unsigned int numMeshes;
+	unsigned int numMaterials;
+
+	// set if every index was inside its mesh's vertices when the cache
+	// was written, so mapping it doesn't have to read all of them
+	unsigned int indicesChecked;
+
+};
+
+struct CachedMesh {
+
+	int materialID;
+	unsigned int numIndices;
+	unsigned int numVertices;
+
+	// file offset of each stream, 0 if the mesh doesn't have it
+	unsigned long long offsets[NUM_STREAMS];
+
+};
+
+static bool HasExtension(const std::string& filepath, const std::string& extension)
+{
+	if ( filepath.size() <= extension.size() )
+		return false;
+
+	for ( size_t i = 0; i < extension.size(); ++i )
+		if ( tolower(filepath[filepath.size() - extension.size() + i]) != tolower(extension[i]) )
+			return false;
+
+	return true;
+}
 
 
 /////// MESH ////////
 
-Mesh::Mesh(const aiMesh* ai_mesh)
+Mesh::Mesh(const MeshData* data)
 	:
-	ai_mesh(ai_mesh)
+	data(data)
 {
 }
 
 int Mesh::NumTriangles() const
 {
-	return ai_mesh->mNumFaces;
+	return data->numIndices / 3;
 }
 
 int Mesh::Indices(int index) const
 {
-	return ai_mesh->mFaces[index / 3].mIndices[index % 3];
+	return data->indices[index];
 }
 
 int Mesh::NumVertices() const
 {
-	return ai_mesh->mNumVertices;
+	return data->numVertices;
 }
 
 Vec3 Mesh::Positions(int index) const
 {
-	aiVector3D vec = ai_mesh->mVertices[index];
-	return { vec.x, vec.y, vec.z };
+	return data->positions[index];
 }
 
 bool Mesh::HasNormals() const
 {
-	return ai_mesh->HasNormals();
+	return data->normals != nullptr;
 }
 
 Vec3 Mesh::Normals(int index) const
 {
-	aiVector3D vec = ai_mesh->mNormals[index];
-	return { vec.x, vec.y, vec.z };
+	return data->normals[index];
 }
 
 bool Mesh::HasTextureCoords() const
 {
-	return ai_mesh->HasTextureCoords(0);
+	return data->textureCoords != nullptr;
 }
 
 Vec2 Mesh::TextureCoords(int index) const
 {
-	aiVector3D vec = ai_mesh->mTextureCoords[0][index];
-	return { vec.x, 1 - vec.y };
+	return data->textureCoords[index];
 }
 
 bool Mesh::HasColors() const
 {
-	return ai_mesh->HasVertexColors(0);
+	return data->colors != nullptr;
 }
 
 Vec3 Mesh::Colors(int index) const
 {
-	aiColor4D vec = ai_mesh->mColors[0][index];
-	return { vec.r, vec.g, vec.b };
+	return data->colors[index];
 }
 
 bool Mesh::HasTangentsAndBitangents() const
 {
-	return ai_mesh->HasTangentsAndBitangents();
+	return data->tangents != nullptr;
 }
 
 Vec3 Mesh::Tangents(int index) const
 {
-	aiVector3D vec = ai_mesh->mTangents[index];
-	return { vec.x, vec.y, vec.z };
+	return data->tangents[index];
 }
 
 Vec3 Mesh::Bitangents(int index) const
 {
-	aiVector3D vec = ai_mesh->mBitangents[index];
-	return { vec.x, vec.y, vec.z };
+	return data->bitangents[index];
 }
 
 int Mesh::MaterialID() const
 {
-	return ai_mesh->mMaterialIndex;
+	return data->materialID;
+}
+
+const int* Mesh::IndexData() const
+{
+	return data->indices;
+}
+
+const Vec3* Mesh::PositionData() const
+{
+	return data->positions;
+}
+
+const Vec3* Mesh::NormalData() const
+{
+	return data->normals;
+}
+
+const Vec2* Mesh::TextureCoordData() const
+{
+	return data->textureCoords;
+}
+
+const Vec3* Mesh::ColorData() const
+{
+	return data->colors;
+}
+
+const Vec3* Mesh::TangentData() const
+{
+	return data->tangents;
+}
+
+const Vec3* Mesh::BitangentData() const
+{
+	return data->bitangents;
+}
+
+// below this many elements a copy isn't worth waking other threads for
+#define PARALLEL_COPY_GRAIN (1 << 16)
+
+template <class T>
+static void CopyStream(const T* source, int count, void* dest, int stride)
+{
+	if ( source == nullptr )
+		return;
+
+	ThreadPool::Global().ParallelFor(count, PARALLEL_COPY_GRAIN, [=](int begin, int end) {
+
+		if ( stride == sizeof(T) ) {
+			memcpy((T*)dest + begin, source + begin, (end - begin) * sizeof(T));
+			return;
+		}
+
+		char* pDest = (char*)dest + (size_t)begin * stride;
+		for ( int i = begin; i < end; ++i, pDest += stride )
+			memcpy(pDest, &source[i], sizeof(T));
+	});
+}
+
+void Mesh::CopyIndices(int* dest) const
+{
+	CopyStream(data->indices, data->numIndices, dest, sizeof(int));
+}
+
+void Mesh::CopyPositions(void* dest, int stride) const
+{
+	CopyStream(data->positions, data->numVertices, dest, stride);
+}
+
+void Mesh::CopyNormals(void* dest, int stride) const
+{
+	CopyStream(data->normals, data->numVertices, dest, stride);
+}
+
+void Mesh::CopyTextureCoords(void* dest, int stride) const
+{
+	CopyStream(data->textureCoords, data->numVertices, dest, stride);
+}
+
+void Mesh::CopyColors(void* dest, int stride) const
+{
+	CopyStream(data->colors, data->numVertices, dest, stride);
+}
+
+void Mesh::CopyTangents(void* dest, int stride) const
+{
+	CopyStream(data->tangents, data->numVertices, dest, stride);
+}
+
+void Mesh::CopyBitangents(void* dest, int stride) const
+{
+	CopyStream(data->bitangents, data->numVertices, dest, stride);
 }
 
 
 /////// MATERIAL ////////
 
-Material::Material(const aiMaterial* ai_material, const std::string& sceneDir)
+Material::Material(const MaterialData* data, const std::string& sceneDir)
 	:
-	ai_material(ai_material), sceneDir(sceneDir)
+	data(data), sceneDir(sceneDir)
 {
 }
 
 Vec3 Material::Diffuse() const
 {
-	aiColor3D color;
-	ai_material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
-
-	return { color.r, color.g, color.b };
+	return data->diffuse;
 }
 
 Vec3 Material::Ambient() const
 {
-	aiColor3D color;
-	ai_material->Get(AI_MATKEY_COLOR_AMBIENT, color);
-
-	return { color.r, color.g, color.b };
+	return data->ambient;
 }
 
 Vec3 Material::Specular() const
 {
-	aiColor3D color;
-	ai_material->Get(AI_MATKEY_COLOR_SPECULAR, color);
-
-	return { color.r, color.g, color.b };
+	return data->specular;
 }
 
 Vec3 Material::Emissive() const
 {
-	aiColor3D color;
-	ai_material->Get(AI_MATKEY_COLOR_EMISSIVE, color);
-
-	return { color.r, color.g, color.b };
+	return data->emissive;
 }
 
 float Material::SpecularExponent() const
 {
-	float exponent;
-	ai_material->Get(AI_MATKEY_COLOR_DIFFUSE, exponent);
-
-	return exponent;
+	return data->specularExponent;
 }
 
 std::string Material::AmbientTexture() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_AMBIENT, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::AMBIENT_TEXTURE];
 }
 
 std::string Material::DiffuseTexture() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_DIFFUSE, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::DIFFUSE_TEXTURE];
 }
 
 std::string Material::SpecularTexture() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_SPECULAR, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::SPECULAR_TEXTURE];
 }
 
 std::string Material::EmissiveTexture() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_EMISSIVE, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::EMISSIVE_TEXTURE];
 }
 
 std::string Material::HeightMap() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_HEIGHT, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::HEIGHT_MAP];
 }
 
 std::string Material::NormalMap() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_NORMALS, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::NORMAL_MAP];
 }
 
 std::string Material::GlossMap() const
 {
-	aiString texPath;
-	ai_material->GetTexture(aiTextureType::aiTextureType_SHININESS, 0, &texPath);
-
-	return (sceneDir + texPath.C_Str());
+	return sceneDir + data->textures[MaterialData::GLOSS_MAP];
 }
 
 
 
 /////// SCENE ////////
 
-Scene::Scene(const std::string& filepath)
+Scene::Scene(const std::string& filepath, bool useCache)
 	:
 	directory(filepath.substr(0, filepath.find_last_of("/") + 1))
 {
-	ai_scene = ai_importer.ReadFile(filepath, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+	if ( HasExtension(filepath, CACHE_EXTENSION) ) {
+
+		if ( !MapCache(filepath, "") )
+			std::cout << "Could not open scene " << filepath << std::endl;
+
+		return;
+	}
+
+	std::string cachePath = filepath + CACHE_EXTENSION;
+
+	if ( useCache && MapCache(cachePath, filepath) )
+		return;
+
+	// OBJ and binary PLY files are read natively, anything else
+	// or a file the native loaders can't handle goes to Assimp
+	bool imported = (HasExtension(filepath, ".obj") && ImportNative(filepath, LoadObj)) ||
+		(HasExtension(filepath, ".ply") && ImportNative(filepath, LoadPly)) ||
+		ImportWithAssimp(filepath);
+
+	if ( imported && useCache )
+		WriteCache(cachePath, filepath);
+}
+
+bool Scene::SetMeshArrays(std::vector<MeshArrays>&& arrays)
+{
+	// the counts are ints from here on, a bigger mesh would wrap around
+	for ( size_t m = 0; m < arrays.size(); ++m ) {
+		if ( arrays[m].indices.size() > INT_MAX || arrays[m].positions.size() > INT_MAX ) {
+
+			std::cout << "Mesh " << m << " has too many indices or vertices" << std::endl;
+
+			meshes.clear();
+			meshArrays.clear();
+			return false;
+		}
+	}
+
+	meshArrays = std::move(arrays);
+	meshes.resize(meshArrays.size());
+
+	// an empty stream is a null pointer, same as a missing stream in the cache
+	auto data = [](const auto& stream) { return stream.empty() ? nullptr : stream.data(); };
+
+	for ( size_t m = 0; m < meshArrays.size(); ++m ) {
+
+		const MeshArrays& arrays = meshArrays[m];
+		MeshData& mesh = meshes[m];
+
+		mesh.numIndices = (int)arrays.indices.size();
+		mesh.numVertices = (int)arrays.positions.size();
+
+		mesh.indices = data(arrays.indices);
+		mesh.positions = data(arrays.positions);
+		mesh.normals = data(arrays.normals);
+		mesh.textureCoords = data(arrays.textureCoords);
+		mesh.colors = data(arrays.colors);
+		mesh.tangents = data(arrays.tangents);
+		mesh.bitangents = data(arrays.bitangents);
+
+		mesh.materialID = arrays.materialID;
+	}
+
+	return true;
+}
+
+bool Scene::ImportNative(const std::string& filepath, NativeLoader loader)
+{
+	std::vector<MeshArrays> arrays;
+	std::vector<MaterialData> loadedMaterials;
+
+	if ( !loader(filepath, arrays, loadedMaterials) )
+		return false;
+
+	if ( !SetMeshArrays(std::move(arrays)) )
+		return false;
+
+	mappedFile.reset();
+	materials = std::move(loadedMaterials);
+
+	return true;
+}
+
+bool Scene::ImportWithAssimp(const std::string& filepath)
+{
+	Assimp::Importer ai_importer;
+	const aiScene* ai_scene = ai_importer.ReadFile(filepath, IMPORT_FLAGS);
 
-	if ( ai_scene == nullptr )
+	if ( ai_scene == nullptr ) {
 		std::cout << ai_importer.GetErrorString() << std::endl;
+		return false;
+	}
+
+	// copy everything out of assimp's structures, the importer
+	// frees them when it goes out of scope
+	materials.clear();
+	mappedFile.reset();
+
+	std::vector<MeshArrays> arrays(ai_scene->mNumMeshes);
+
+	for ( unsigned int m = 0; m < ai_scene->mNumMeshes; ++m ) {
+
+		const aiMesh* ai_mesh = ai_scene->mMeshes[m];
+		MeshArrays& mesh = arrays[m];
+
+		mesh.materialID = ai_mesh->mMaterialIndex;
+
+		// triangulation leaves points and lines alone,
+		// those become degenerate triangles
+		mesh.indices.resize(ai_mesh->mNumFaces * 3);
+		for ( unsigned int f = 0; f < ai_mesh->mNumFaces; ++f ) {
+
+			const aiFace& face = ai_mesh->mFaces[f];
+
+			for ( unsigned int i = 0; i < 3; ++i )
+				mesh.indices[f * 3 + i] = face.mIndices[i < face.mNumIndices ? i : 0];
+		}
+
+		unsigned int nVertices = ai_mesh->mNumVertices;
+
+		// assimp's vectors have the same layout as ours,
+		// so whole streams are copied at once
+		static_assert(sizeof(aiVector3D) == sizeof(Vec3), "aiVector3D and Vec3 differ in size");
+
+		mesh.positions.resize(nVertices);
+		memcpy(mesh.positions.data(), ai_mesh->mVertices, nVertices * sizeof(Vec3));
+
+		if ( ai_mesh->HasNormals() ) {
+			mesh.normals.resize(nVertices);
+			memcpy(mesh.normals.data(), ai_mesh->mNormals, nVertices * sizeof(Vec3));
+		}
+
+		if ( ai_mesh->HasTextureCoords(0) ) {
+
+			// flip t so the origin is the top left of the texture
+			mesh.textureCoords.resize(nVertices);
+			for ( unsigned int i = 0; i < nVertices; ++i )
+				mesh.textureCoords[i] = { ai_mesh->mTextureCoords[0][i].x, 1 - ai_mesh->mTextureCoords[0][i].y };
+		}
+
+		if ( ai_mesh->HasVertexColors(0) ) {
+			mesh.colors.resize(nVertices);
+			for ( unsigned int i = 0; i < nVertices; ++i )
+				mesh.colors[i] = { ai_mesh->mColors[0][i].r, ai_mesh->mColors[0][i].g, ai_mesh->mColors[0][i].b };
+		}
+
+		if ( ai_mesh->HasTangentsAndBitangents() ) {
+
+			mesh.tangents.resize(nVertices);
+			mesh.bitangents.resize(nVertices);
+
+			memcpy(mesh.tangents.data(), ai_mesh->mTangents, nVertices * sizeof(Vec3));
+			memcpy(mesh.bitangents.data(), ai_mesh->mBitangents, nVertices * sizeof(Vec3));
+		}
+	}
+
+	if ( !SetMeshArrays(std::move(arrays)) )
+		return false;
+
+	materials.resize(ai_scene->mNumMaterials);
+
+	static const aiTextureType textureTypes[MaterialData::NUM_TEXTURES] = {
+		aiTextureType_AMBIENT,
+		aiTextureType_DIFFUSE,
+		aiTextureType_SPECULAR,
+		aiTextureType_EMISSIVE,
+		aiTextureType_HEIGHT,
+		aiTextureType_NORMALS,
+		aiTextureType_SHININESS
+	};
+
+	for ( unsigned int m = 0; m < ai_scene->mNumMaterials; ++m ) {
+
+		const aiMaterial* ai_material = ai_scene->mMaterials[m];
+		MaterialData& material = materials[m];
+
+		aiColor3D color;
+
+		ai_material->Get(AI_MATKEY_COLOR_DIFFUSE, color);
+		material.diffuse = { color.r, color.g, color.b };
+
+		ai_material->Get(AI_MATKEY_COLOR_AMBIENT, color);
+		material.ambient = { color.r, color.g, color.b };
+
+		ai_material->Get(AI_MATKEY_COLOR_SPECULAR, color);
+		material.specular = { color.r, color.g, color.b };
+
+		ai_material->Get(AI_MATKEY_COLOR_EMISSIVE, color);
+		material.emissive = { color.r, color.g, color.b };
+
+		material.specularExponent = 0;
+		ai_material->Get(AI_MATKEY_SHININESS, material.specularExponent);
+
+		for ( int t = 0; t < MaterialData::NUM_TEXTURES; ++t ) {
+
+			aiString texPath;
+			ai_material->GetTexture(textureTypes[t], 0, &texPath);
+
+			material.textures[t] = texPath.C_Str();
+		}
+	}
+
+	return true;
+}
+
+static bool IndicesInRange(const MeshData& mesh)
+{
+	for ( int i = 0; i < mesh.numIndices; ++i )
+		if ( mesh.indices[i] < 0 || mesh.indices[i] >= mesh.numVertices )
+			return false;
+
+	return true;
+}
+
+// returns a pointer to count elements at offset in the mapping,
+// or null if the stream is absent or doesn't fit in the file
+template <class T>
+static const T* MapStream(const MappedFile& file, unsigned long long offset, unsigned int count, bool& valid)
+{
+	if ( offset == 0 )
+		return nullptr;
+
+	if ( offset % CACHE_ALIGNMENT != 0 || offset > file.GetSize() || (file.GetSize() - offset) / sizeof(T) < count ) {
+		valid = false;
+		return nullptr;
+	}
+
+	return (const T*)(file.GetData() + offset);
+}
+
+bool Scene::MapCache(const std::string& cachePath, const std::string& filepath)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(cachePath);
+	if ( !file->IsOpen() || file->GetSize() < sizeof(CacheHeader) )
+		return false;
+
+	const char* pFile = file->GetData();
+	const char* pEnd = pFile + file->GetSize();
+
+	CacheHeader header;
+	memcpy(&header, pFile, sizeof(header));
+
+	if ( memcmp(header.magic, "RTSC", 4) != 0 || header.version != CACHE_VERSION || header.importFlags != IMPORT_FLAGS )
+		return false;
+
+	if ( !filepath.empty() ) {
+
+		long long sourceSize, sourceTime;
+		if ( !MappedFile::GetFileStamp(filepath, sourceSize, sourceTime) || header.sourceSize != sourceSize || header.sourceTime != sourceTime )
+			return false;
+	}
+
+	const char* pRead = pFile + sizeof(header);
+
+	// the colors, the exponent and a length for each texture name, a damaged
+	// count can't ask for more materials than the rest of the file could hold
+	static constexpr size_t MIN_MATERIAL_SIZE = 4 * sizeof(Vec3) + sizeof(float) + MaterialData::NUM_TEXTURES * sizeof(unsigned int);
+
+	if ( header.numMaterials > (size_t)(pEnd - pRead) / MIN_MATERIAL_SIZE ) {
+		std::cout << "Scene cache " << cachePath << " is damaged" << std::endl;
+		return false;
+	}
+
+	// materials are small, copy them out so their strings can be used normally
+	std::vector<MaterialData> cachedMaterials(header.numMaterials);
+
+	auto read = [&](void* dest, size_t size) {
+
+		if ( (size_t)(pEnd - pRead) < size )
+			return false;
+
+		memcpy(dest, pRead, size);
+		pRead += size;
+		return true;
+	};
+
+	for ( MaterialData& material : cachedMaterials ) {
+
+		bool valid = read(&material.diffuse, sizeof(Vec3)) && read(&material.ambient, sizeof(Vec3)) &&
+			read(&material.specular, sizeof(Vec3)) && read(&material.emissive, sizeof(Vec3)) &&
+			read(&material.specularExponent, sizeof(float));
+
+		for ( std::string& texture : material.textures ) {
+
+			unsigned int length;
+			if ( !valid || !read(&length, sizeof(length)) || (size_t)(pEnd - pRead) < length ) {
+				valid = false;
+				break;
+			}
+
+			texture.assign(pRead, length);
+			pRead += length;
+		}
+
+		if ( !valid )
+			return false;
+	}
+
+	// the mesh table starts on the first aligned offset after the materials
+	unsigned long long tableOffset = ((unsigned long long)(pRead - pFile) + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+	if ( tableOffset > file->GetSize() || (file->GetSize() - tableOffset) / sizeof(CachedMesh) < header.numMeshes )
+		return false;
+
+	const CachedMesh* table = (const CachedMesh*)(pFile + tableOffset);
+
+	std::vector<MeshData> mappedMeshes(header.numMeshes);
+	bool valid = true;
+
+	for ( unsigned int m = 0; m < header.numMeshes; ++m ) {
+
+		const CachedMesh& cached = table[m];
+		MeshData& mesh = mappedMeshes[m];
+
+		mesh.numIndices = cached.numIndices;
+		mesh.numVertices = cached.numVertices;
+		mesh.materialID = cached.materialID;
+
+		// every loader gives each mesh one of the scene's materials
+		if ( cached.materialID < 0 || cached.materialID >= (int)header.numMaterials )
+			valid = false;
+
+		mesh.indices = MapStream<int>(*file, cached.offsets[STREAM_INDICES], cached.numIndices, valid);
+		mesh.positions = MapStream<Vec3>(*file, cached.offsets[STREAM_POSITIONS], cached.numVertices, valid);
+		mesh.normals = MapStream<Vec3>(*file, cached.offsets[STREAM_NORMALS], cached.numVertices, valid);
+		mesh.textureCoords = MapStream<Vec2>(*file, cached.offsets[STREAM_TEXTURE_COORDS], cached.numVertices, valid);
+		mesh.colors = MapStream<Vec3>(*file, cached.offsets[STREAM_COLORS], cached.numVertices, valid);
+		mesh.tangents = MapStream<Vec3>(*file, cached.offsets[STREAM_TANGENTS], cached.numVertices, valid);
+		mesh.bitangents = MapStream<Vec3>(*file, cached.offsets[STREAM_BITANGENTS], cached.numVertices, valid);
+
+		// an index outside the vertex arrays would be read by the renderer
+		// without any checks. They were checked when the cache was written,
+		// reading them all again here would page in the whole stream
+		if ( valid && !header.indicesChecked && mesh.indices != nullptr )
+			valid = IndicesInRange(mesh);
+	}
+
+	if ( !valid ) {
+		std::cout << "Scene cache " << cachePath << " is damaged" << std::endl;
+		return false;
+	}
+
+	meshes = std::move(mappedMeshes);
+	materials = std::move(cachedMaterials);
+	meshArrays.clear();
+	mappedFile = std::move(file);
+
+	return true;
+}
+
+static void PadToAlignment(std::ofstream& file)
+{
+	static const char zeros[CACHE_ALIGNMENT] = {};
+
+	unsigned long long position = file.tellp();
+	unsigned long long padding = (CACHE_ALIGNMENT - position % CACHE_ALIGNMENT) % CACHE_ALIGNMENT;
+
+	file.write(zeros, padding);
+}
+
+template <class T>
+static unsigned long long WriteStream(std::ofstream& file, const T* stream, unsigned int count)
+{
+	if ( stream == nullptr )
+		return 0;
+
+	PadToAlignment(file);
+
+	unsigned long long offset = file.tellp();
+	file.write((const char*)stream, (std::streamsize)count * sizeof(T));
+
+	return offset;
+}
+
+void Scene::WriteCache(const std::string& cachePath, const std::string& filepath) const
+{
+	CacheHeader header = {};
+	memcpy(header.magic, "RTSC", 4);
+	header.version = CACHE_VERSION;
+	header.importFlags = IMPORT_FLAGS;
+	header.numMeshes = (unsigned int)meshes.size();
+	header.numMaterials = (unsigned int)materials.size();
+
+	header.indicesChecked = 1;
+	for ( const MeshData& mesh : meshes )
+		if ( mesh.indices != nullptr && !IndicesInRange(mesh) )
+			header.indicesChecked = 0;
+
+	if ( !MappedFile::GetFileStamp(filepath, header.sourceSize, header.sourceTime) )
+		return;
+
+	// other processes may have the old cache mapped, it is replaced once the new one is complete
+	bool written = MappedFile::WriteFileAtomically(cachePath, [&](std::ofstream& file) {
+
+		file.write((const char*)&header, sizeof(header));
+
+		for ( const MaterialData& material : materials ) {
+
+			file.write((const char*)&material.diffuse, sizeof(Vec3));
+			file.write((const char*)&material.ambient, sizeof(Vec3));
+			file.write((const char*)&material.specular, sizeof(Vec3));
+			file.write((const char*)&material.emissive, sizeof(Vec3));
+			file.write((const char*)&material.specularExponent, sizeof(float));
+
+			for ( const std::string& texture : material.textures ) {
+
+				unsigned int length = (unsigned int)texture.size();
+				file.write((const char*)&length, sizeof(length));
+				file.write(texture.data(), length);
+			}
+		}
+
+		// leave room for the mesh table, it is filled in once
+		// the offsets of the streams are known
+		PadToAlignment(file);
+
+		unsigned long long tableOffset = file.tellp();
+		std::vector<CachedMesh> table(meshes.size());
+
+		file.write((const char*)table.data(), table.size() * sizeof(CachedMesh));
+
+		for ( size_t m = 0; m < meshes.size(); ++m ) {
+
+			const MeshData& mesh = meshes[m];
+			CachedMesh& cached = table[m];
+
+			cached.materialID = mesh.materialID;
+			cached.numIndices = mesh.numIndices;
+			cached.numVertices = mesh.numVertices;
+
+			cached.offsets[STREAM_INDICES] = WriteStream(file, mesh.indices, mesh.numIndices);
+			cached.offsets[STREAM_POSITIONS] = WriteStream(file, mesh.positions, mesh.numVertices);
+			cached.offsets[STREAM_NORMALS] = WriteStream(file, mesh.normals, mesh.numVertices);
+			cached.offsets[STREAM_TEXTURE_COORDS] = WriteStream(file, mesh.textureCoords, mesh.numVertices);
+			cached.offsets[STREAM_COLORS] = WriteStream(file, mesh.colors, mesh.numVertices);
+			cached.offsets[STREAM_TANGENTS] = WriteStream(file, mesh.tangents, mesh.numVertices);
+			cached.offsets[STREAM_BITANGENTS] = WriteStream(file, mesh.bitangents, mesh.numVertices);
+		}
+
+		file.seekp(tableOffset);
+		file.write((const char*)table.data(), table.size() * sizeof(CachedMesh));
+
+	});
+
+	if ( !written )
+		std::cout << "Could not write scene cache " << cachePath << std::endl;
 }
 
 int Scene::NumMeshes() const
 {
-	return ai_scene->mNumMeshes;
+	return (int)meshes.size();
 }
 
 Mesh Scene::MeshAt(int meshIndex) const
 {
-	return { ai_scene->mMeshes[meshIndex] };
+	return { &meshes[meshIndex] };
 }
 
 int Scene::NumMaterials() const
 {
-	return ai_scene->mNumMaterials;
+	return (int)materials.size();
 }
 
 Material Scene::MaterialAt(int materialIndex) const
 {
-	const aiMaterial* material = ai_scene->mMaterials[materialIndex];
+	return { &materials[materialIndex], directory };
+}
+
+size_t Scene::GetMemoryUsage() const
+{
+	size_t usage = 0;
+
+	for ( const MeshData& mesh : meshes ) {
+
+		usage += (size_t)mesh.numIndices * sizeof(int);
+
+		size_t vertexSize = sizeof(Vec3);
+		vertexSize += mesh.normals != nullptr ? sizeof(Vec3) : 0;
+		vertexSize += mesh.textureCoords != nullptr ? sizeof(Vec2) : 0;
+		vertexSize += mesh.colors != nullptr ? sizeof(Vec3) : 0;
+		vertexSize += mesh.tangents != nullptr ? sizeof(Vec3) * 2 : 0;
+
+		usage += (size_t)mesh.numVertices * vertexSize;
+	}
 
-	return { material, directory };
+	return usage;
 }
@@ -1,18 +1,84 @@
 #pragma once
-#include <assimp/Importer.hpp>
 #include "Vec3.h"
 #include "Vec2.h"
 #include <string>
+#include <vector>
+#include <memory>
 
 // WRAPPER FOR THE ASSIMP LIBRARY
+// OBJ and binary PLY files are read by native loaders, see ObjLoader.h and PlyLoader.h
 
-// assimp structs used by these classes
-class aiMesh;
-class aiMaterial;
-class aiScene;
+// Imported scenes are flattened into plain arrays. The arrays are cached in
+// a binary file next to the source file, so later loads of an unchanged file
+// map the cache into memory instead of running Assimp. A mapped scene never
+// copies its meshes, the arrays are used right where they sit in the file.
 
 class Scene;
 class Mesh;
+class MappedFile;
+
+// arrays of a mesh that was imported, and has to be stored somewhere
+struct MeshArrays {
+
+	std::vector<int> indices;
+	std::vector<Vec3> positions;
+
+	// these are empty if the mesh doesn't have them
+	std::vector<Vec3> normals;
+	std::vector<Vec2> textureCoords;
+	std::vector<Vec3> colors;
+	std::vector<Vec3> tangents;
+	std::vector<Vec3> bitangents;
+
+	int materialID;
+
+};
+
+// points to the arrays of a mesh, either in a MeshArrays
+// owned by the scene or in a mapped cache file
+struct MeshData {
+
+	int numIndices;
+	int numVertices;
+
+	const int* indices;
+	const Vec3* positions;
+
+	// these are null if the mesh doesn't have them
+	const Vec3* normals;
+	const Vec2* textureCoords;
+	const Vec3* colors;
+	const Vec3* tangents;
+	const Vec3* bitangents;
+
+	int materialID;
+
+};
+
+struct MaterialData {
+
+	enum {
+		AMBIENT_TEXTURE,
+		DIFFUSE_TEXTURE,
+		SPECULAR_TEXTURE,
+		EMISSIVE_TEXTURE,
+		HEIGHT_MAP,
+		NORMAL_MAP,
+		GLOSS_MAP,
+		NUM_TEXTURES
+	};
+
+	Vec3 diffuse;
+	Vec3 ambient;
+	Vec3 specular;
+	Vec3 emissive;
+
+	float specularExponent;
+
+	// relative to the scene's directory, empty if there is no texture
+	std::string textures[NUM_TEXTURES];
+
+};
 
 class Mesh {
 
@@ -20,9 +86,9 @@ class Mesh {
 
 private:
 
-	const aiMesh* ai_mesh;
+	const MeshData* data;
 
-	Mesh(const aiMesh* ai_mesh);
+	Mesh(const MeshData* data);
 
 public:
 
@@ -48,6 +114,28 @@ public:
 
 	int MaterialID() const;
 
+	// the arrays themselves, valid for as long as the scene is.
+	// The optional streams are null if the mesh doesn't have them
+	const int* IndexData() const;
+	const Vec3* PositionData() const;
+	const Vec3* NormalData() const;
+	const Vec2* TextureCoordData() const;
+	const Vec3* ColorData() const;
+	const Vec3* TangentData() const;
+	const Vec3* BitangentData() const;
+
+	// copy a whole stream into a caller's buffer. For the vertex streams
+	// dest points at the member of the first vertex and stride is the
+	// size of a vertex in bytes, so interleaved buffers can be filled
+	// directly. Large meshes are copied on several threads.
+	void CopyIndices(int* dest) const;
+	void CopyPositions(void* dest, int stride = sizeof(Vec3)) const;
+	void CopyNormals(void* dest, int stride = sizeof(Vec3)) const;
+	void CopyTextureCoords(void* dest, int stride = sizeof(Vec2)) const;
+	void CopyColors(void* dest, int stride = sizeof(Vec3)) const;
+	void CopyTangents(void* dest, int stride = sizeof(Vec3)) const;
+	void CopyBitangents(void* dest, int stride = sizeof(Vec3)) const;
+
 };
 
 class Material {
@@ -55,10 +143,10 @@ class Material {
 	friend class Scene;
 
 private:
-	const aiMaterial* ai_material;
+	const MaterialData* data;
 	const std::string sceneDir;
 
-	Material(const aiMaterial* ai_material, const std::string& sceneDir);
+	Material(const MaterialData* data, const std::string& sceneDir);
 
 public:
 
@@ -82,15 +170,41 @@ public:
 class Scene {
 
 private:
-	
-	Assimp::Importer ai_importer;
 
-	const aiScene* ai_scene;
+	std::vector<MeshData> meshes;
+	std::vector<MaterialData> materials;
+
+	// whatever the meshes point into, only one of these is used
+	std::vector<MeshArrays> meshArrays;
+	std::shared_ptr<const MappedFile> mappedFile;
+
 	const std::string directory;
 
+	// fails on a mesh with more than INT_MAX indices or vertices
+	bool SetMeshArrays(std::vector<MeshArrays>&& arrays);
+
+	// the loaders that read a format without Assimp
+	typedef bool (*NativeLoader)(const std::string& filepath, std::vector<MeshArrays>& outMeshes, std::vector<MaterialData>& outMaterials);
+
+	bool ImportNative(const std::string& filepath, NativeLoader loader);
+	bool ImportWithAssimp(const std::string& filepath);
+
+	// filepath is the source the cache was made from, if it is
+	// empty the cache is used without checking it is up to date
+	bool MapCache(const std::string& cachePath, const std::string& filepath);
+	void WriteCache(const std::string& cachePath, const std::string& filepath) const;
+
 public:
 
-	Scene(const std::string& filepath);
+	// cached scenes are stored at the file path with this appended,
+	// a file with this extension can also be opened directly
+	static const char* const CACHE_EXTENSION;
+
+	Scene(const std::string& filepath, bool useCache = true);
+
+	// meshes point into storage owned by the scene
+	Scene(const Scene&) = delete;
+	Scene& operator=(const Scene&) = delete;
 
 	int NumMeshes() const;
 	Mesh MeshAt(int meshIndex) const;
@@ -98,4 +212,7 @@ public:
 	int NumMaterials() const;
 	Material MaterialAt(int materialIndex) const;
 
+	// bytes used by the meshes, including ones in a mapped cache
+	size_t GetMemoryUsage() const;
+
 };
@@ -0,0 +1,116 @@
+#include "IrradianceSH.h"
+#include "Sampling.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <math.h>
+
+// the projection doesn't need more detail than this
+#define PROJECTION_SIZE 128
+
+IrradianceSH::IrradianceSH(const Surface* const planes[6])
+{
+	// mip maps average texels, which is all the
+	// projection would do with the extra detail
+	const Surface* faces[6];
+
+	for ( int f = 0; f < 6; ++f ) {
+
+		int level = 0;
+		while ( planes[f]->GetMipMap(level)->GetWidth() > PROJECTION_SIZE && planes[f]->GetMipMap(level + 1) != planes[f]->GetMipMap(level) )
+			++level;
+
+		faces[f] = planes[f]->GetMipMap(level);
+	}
+
+	// one partial sum per row of every face. The rows are added up in order
+	// afterwards, so the rounding doesn't depend on how the rows were split
+	std::vector<int> rowStarts(7, 0);
+	for ( int f = 0; f < 6; ++f )
+		rowStarts[f + 1] = rowStarts[f] + faces[f]->GetHeight();
+
+	std::vector<Vec3> rowSums((size_t)rowStarts[6] * 9);
+
+	ThreadPool::Global().ParallelFor(rowStarts[6], 1, [&](int begin, int end) {
+
+		for ( int row = begin; row < end; ++row ) {
+
+			int f = 0;
+			while ( row >= rowStarts[f + 1] )
+				++f;
+
+			const Surface* face = faces[f];
+			int y = row - rowStarts[f];
+
+			int width = face->GetWidth();
+			int height = face->GetHeight();
+
+			Vec3* sums = &rowSums[(size_t)row * 9];
+
+			for ( int x = 0; x < width; ++x ) {
+
+				Vec3 dir = CubeMapDirection(f, { (x + 0.5f) / width, (y + 0.5f) / height });
+
+				// the solid angle of a texel of a face 2 units wide at distance 1
+				float distance2 = dir * dir;
+				float solidAngle = (4.0f / (width * height)) / (distance2 * sqrtf(distance2));
+
+				dir /= sqrtf(distance2);
+				Vec3 color = face->GetPixel(x, y).Vec3() * solidAngle;
+
+				sums[0] += color * 0.282095f;
+
+				sums[1] += color * (0.488603f * dir.y);
+				sums[2] += color * (0.488603f * dir.z);
+				sums[3] += color * (0.488603f * dir.x);
+
+				sums[4] += color * (1.092548f * dir.x * dir.y);
+				sums[5] += color * (1.092548f * dir.y * dir.z);
+				sums[6] += color * (0.315392f * (3 * dir.z * dir.z - 1));
+				sums[7] += color * (1.092548f * dir.x * dir.z);
+				sums[8] += color * (0.546274f * (dir.x * dir.x - dir.y * dir.y));
+			}
+		}
+
+	});
+
+	for ( int i = 0; i < 9; ++i )
+		coefficients[i] = {};
+
+	for ( int row = 0; row < rowStarts[6]; ++row )
+		for ( int i = 0; i < 9; ++i )
+			coefficients[i] += rowSums[(size_t)row * 9 + i];
+}
+
+Vec3 IrradianceSH::Irradiance(const Vec3& normal) const
+{
+	// Equation 13, Ramamoorthi and Hanrahan
+	const float c1 = 0.429043f;
+	const float c2 = 0.511664f;
+	const float c3 = 0.743125f;
+	const float c4 = 0.886227f;
+	const float c5 = 0.247708f;
+
+	float x = normal.x;
+	float y = normal.y;
+	float z = normal.z;
+
+	const Vec3* L = coefficients;
+
+	Vec3 irradiance = L[8] * (c1 * (x * x - y * y)) + L[6] * (c3 * z * z) + L[0] * c4 - L[6] * c5 +
+		(L[4] * (x * y) + L[7] * (x * z) + L[5] * (y * z)) * (2 * c1) +
+		(L[3] * x + L[1] * y + L[2] * z) * (2 * c2);
+
+	irradiance /= (float)PI;
+
+	// ringing can take dim directions slightly below 0
+	if ( irradiance.x < 0 ) irradiance.x = 0;
+	if ( irradiance.y < 0 ) irradiance.y = 0;
+	if ( irradiance.z < 0 ) irradiance.z = 0;
+
+	return irradiance;
+}
+
+const Vec3* IrradianceSH::GetCoefficients() const
+{
+	return coefficients;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "Surface.h"
+#include "Vec3.h"
+
+// Diffuse light from an environment cube map as 9 spherical harmonic
+// coefficients per color channel. After the projection, the light
+// reaching a surface is a short polynomial in its normal, so ambient
+// lighting from the sky costs no rays.
+// "An Efficient Representation for Irradiance Environment Maps", Ramamoorthi and Hanrahan
+
+class IrradianceSH
+{
+private:
+	// in the order L00, L1-1, L10, L11, L2-2, L2-1, L20, L21, L22
+	Vec3 coefficients[9];
+
+public:
+	// planes are in the order +x, -x, +y, -y, +z, -z. The projection reads
+	// the largest mip level that is at most 128 texels wide, on the thread
+	// pool, and gives the same result for any number of threads
+	IrradianceSH(const Surface* const planes[6]);
+
+	// light arriving at a surface facing normal, divided by pi, so it is
+	// the diffuse color of a white surface. The normal has to be normalized
+	Vec3 Irradiance(const Vec3& normal) const;
+
+	const Vec3* GetCoefficients() const;
+
+};
@@ -0,0 +1,169 @@
+#include "MappedFile.h"
+#include <atomic>
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename, bool copyOnWrite)
+	:
+	copyOnWrite(copyOnWrite)
+{
+#ifdef _WIN32
+
+	// shared for delete, so WriteFileAtomically can replace a file that is mapped
+	fileHandle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if ( fileHandle == INVALID_HANDLE_VALUE ) {
+		fileHandle = nullptr;
+		return;
+	}
+
+	LARGE_INTEGER fileSize;
+	if ( !GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0 )
+		return;
+
+	mappingHandle = CreateFileMappingA(fileHandle, nullptr, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+	if ( mappingHandle == nullptr )
+		return;
+
+	pData = (const char*)MapViewOfFile(mappingHandle, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if ( pData != nullptr )
+		size = (size_t)fileSize.QuadPart;
+
+#else
+
+	fileDescriptor = open(filename.c_str(), O_RDONLY);
+	if ( fileDescriptor < 0 )
+		return;
+
+	struct stat info;
+	if ( fstat(fileDescriptor, &info) != 0 || info.st_size == 0 )
+		return;
+
+	void* mapping = mmap(nullptr, info.st_size, copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, copyOnWrite ? MAP_PRIVATE : MAP_SHARED, fileDescriptor, 0);
+	if ( mapping == MAP_FAILED )
+		return;
+
+	pData = (const char*)mapping;
+	size = info.st_size;
+
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+
+	if ( pData != nullptr )
+		UnmapViewOfFile(pData);
+	if ( mappingHandle != nullptr )
+		CloseHandle(mappingHandle);
+	if ( fileHandle != nullptr )
+		CloseHandle(fileHandle);
+
+#else
+
+	if ( pData != nullptr )
+		munmap((void*)pData, size);
+	if ( fileDescriptor >= 0 )
+		close(fileDescriptor);
+
+#endif
+}
+
+bool MappedFile::IsOpen() const
+{
+	return pData != nullptr;
+}
+
+const char* MappedFile::GetData() const
+{
+	return pData;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return size;
+}
+
+char* MappedFile::GetWritableData() const
+{
+	return copyOnWrite ? (char*)pData : nullptr;
+}
+
+bool MappedFile::GetFileStamp(const std::string& filename, long long& size, long long& time)
+{
+#ifdef _WIN32
+	struct _stat64 info;
+	if ( _stat64(filename.c_str(), &info) != 0 )
+		return false;
+#else
+	struct stat info;
+	if ( stat(filename.c_str(), &info) != 0 )
+		return false;
+#endif
+
+	size = info.st_size;
+	time = info.st_mtime;
+	return true;
+}
+
+bool MappedFile::WriteFileAtomically(const std::string& filename, const std::function<void(std::ofstream&)>& write)
+{
+	// unique to this process and this call, so concurrent writers
+	// of the same file don't write into each other's temporary file
+	static std::atomic<unsigned int> counter(0);
+
+#ifdef _WIN32
+	unsigned long processId = GetCurrentProcessId();
+#else
+	unsigned long processId = (unsigned long)getpid();
+#endif
+
+	std::string tempPath = filename + "." + std::to_string(processId) + "." + std::to_string(counter++) + ".tmp";
+
+	std::ofstream file(tempPath, std::ios::binary);
+	if ( !file )
+		return false;
+
+	write(file);
+
+	bool written = (bool)file;
+	file.close();
+
+	if ( !written || file.fail() ) {
+		std::remove(tempPath.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+
+	// replaces the old file even while it is open, as long as it was
+	// opened shared for delete like MappedFile does
+	bool replaced = MoveFileExA(tempPath.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+
+	if ( !replaced && GetFileAttributesA(filename.c_str()) != INVALID_FILE_ATTRIBUTES )
+		replaced = ReplaceFileA(filename.c_str(), tempPath.c_str(), nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS, nullptr, nullptr) != 0;
+
+#else
+
+	// rename replaces the old name in one step, mappings of the old file stay valid
+	bool replaced = rename(tempPath.c_str(), filename.c_str()) == 0;
+
+#endif
+
+	if ( !replaced )
+		std::remove(tempPath.c_str());
+
+	return replaced;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <functional>
+
+// Maps a whole file into memory read only. Pages are read from disk the
+// first time they are touched, and every process mapping the same file
+// shares the same physical memory.
+//
+// A copy on write mapping can also be written to. Written pages are
+// copied for this process only, the file itself never changes.
+
+class MappedFile
+{
+private:
+	const char* pData = nullptr;
+	size_t size = 0;
+	bool copyOnWrite;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#else
+	int fileDescriptor = -1;
+#endif
+
+public:
+	MappedFile(const std::string& filename, bool copyOnWrite = false);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool IsOpen() const;
+
+	const char* GetData() const;
+	size_t GetSize() const;
+
+	// null unless the file was mapped copy on write
+	char* GetWritableData() const;
+
+	// size and modification time of a file, used to tell
+	// whether a file made from it is out of date
+	static bool GetFileStamp(const std::string& filename, long long& size, long long& time);
+
+	// write fills a temporary file next to filename, which then replaces
+	// it in one step. Anyone opening filename gets the old file or the
+	// whole new one, and processes with the old one mapped keep their
+	// copy. Returns false and leaves filename as it was if anything fails
+	static bool WriteFileAtomically(const std::string& filename, const std::function<void(std::ofstream&)>& write);
+
+};
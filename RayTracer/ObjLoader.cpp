@@ -0,0 +1,832 @@
+#include "ObjLoader.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+#include <fstream>
+#include <sstream>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <climits>
+#include <memory>
+
+// files are split into about this many bytes per chunk
+#define CHUNK_SIZE (1 << 20)
+
+// corners per task when building meshes
+#define CORNER_GRAIN (1 << 15)
+
+// texture coordinate or normal index of a corner that has none
+#define MISSING_INDEX INT_MAX
+
+struct Corner {
+	int position;
+	int textureCoord;
+	int normal;
+};
+
+struct MaterialSwitch {
+
+	// first triangle in the chunk that uses the material
+	int triangle;
+	std::string name;
+
+};
+
+struct Chunk {
+
+	const char* begin;
+	const char* end;
+
+	// number of each kind of element in the chunk
+	int numPositions = 0;
+	int numTextureCoords = 0;
+	int numNormals = 0;
+
+	// and the number of each in all the chunks before it
+	int firstPosition = 0;
+	int firstTextureCoord = 0;
+	int firstNormal = 0;
+
+	std::vector<Corner> triangles;
+	std::vector<MaterialSwitch> materialSwitches;
+	std::vector<std::string> materialLibraries;
+
+	// colors are rare, they are collected per chunk and
+	// only put together if a chunk has any
+	std::vector<Vec3> colors;
+
+	bool valid = true;
+
+};
+
+// a run of triangles from one chunk that use the same material
+struct Segment {
+	int chunk;
+	int begin;
+	int end;
+};
+
+
+/////// PARSING ////////
+
+static inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool IsDigit(char c)
+{
+	return (unsigned char)(c - '0') < 10;
+}
+
+static inline const char* SkipSpace(const char* p, const char* end)
+{
+	while ( p < end && IsSpace(*p) )
+		++p;
+	return p;
+}
+
+static const double powersOf10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// parses a decimal number without going through the C runtime's locale
+// handling. Up to 19 significant digits are kept, which is more than a
+// float can hold. Returns null if there is no number at p.
+static const char* ParseFloat(const char* p, const char* end, float& out)
+{
+	bool negative = false;
+	if ( p < end && (*p == '-' || *p == '+') ) {
+		negative = *p == '-';
+		++p;
+	}
+
+	unsigned long long mantissa = 0;
+	int significantDigits = 0;
+	int exponent = 0;
+	bool anyDigits = false;
+
+	for ( ; p < end && IsDigit(*p); ++p ) {
+
+		anyDigits = true;
+
+		if ( significantDigits < 19 ) {
+			mantissa = mantissa * 10 + (*p - '0');
+			significantDigits += mantissa != 0;
+		}
+		else {
+			++exponent;
+		}
+	}
+
+	if ( p < end && *p == '.' ) {
+
+		for ( ++p; p < end && IsDigit(*p); ++p ) {
+
+			anyDigits = true;
+
+			if ( significantDigits < 19 ) {
+				mantissa = mantissa * 10 + (*p - '0');
+				significantDigits += mantissa != 0;
+				--exponent;
+			}
+		}
+	}
+
+	if ( !anyDigits )
+		return nullptr;
+
+	if ( p + 1 < end && (*p == 'e' || *p == 'E') ) {
+
+		const char* e = p + 1;
+
+		bool negativeExponent = false;
+		if ( *e == '-' || *e == '+' ) {
+			negativeExponent = *e == '-';
+			++e;
+		}
+
+		if ( e < end && IsDigit(*e) ) {
+
+			int value = 0;
+			for ( ; e < end && IsDigit(*e); ++e )
+				value = std::min(value * 10 + (*e - '0'), 1000);
+
+			exponent += negativeExponent ? -value : value;
+			p = e;
+		}
+	}
+
+	double value = (double)mantissa;
+
+	// powers up to 22 are exact in a double, so these only round once
+	if ( exponent < 0 )
+		value = exponent >= -22 ? value / powersOf10[-exponent] : value * pow(10.0, exponent);
+	else if ( exponent > 0 )
+		value = exponent <= 22 ? value * powersOf10[exponent] : value * pow(10.0, exponent);
+
+	out = (float)(negative ? -value : value);
+	return p;
+}
+
+static const char* ParseInt(const char* p, const char* end, int& out)
+{
+	bool negative = false;
+	if ( p < end && (*p == '-' || *p == '+') ) {
+		negative = *p == '-';
+		++p;
+	}
+
+	if ( p == end || !IsDigit(*p) )
+		return nullptr;
+
+	long long value = 0;
+	for ( ; p < end && IsDigit(*p); ++p )
+		value = std::min(value * 10 + (*p - '0'), (long long)INT_MAX);
+
+	out = (int)(negative ? -value : value);
+	return p;
+}
+
+// turns a 1 based or negative relative index into a 0 based one
+static inline int ResolveIndex(int index, int countSoFar)
+{
+	if ( index > 0 )
+		return index - 1;
+	if ( index < 0 )
+		return countSoFar + index;
+	return INT_MIN;
+}
+
+static inline bool LineStartsWith(const char* p, const char* end, const char* keyword, int length)
+{
+	return end - p > length && memcmp(p, keyword, length) == 0 && IsSpace(p[length]);
+}
+
+static std::string RestOfLine(const char* p, const char* end)
+{
+	p = SkipSpace(p, end);
+	while ( end > p && IsSpace(end[-1]) )
+		--end;
+	return std::string(p, end);
+}
+
+// first pass over a chunk, counts its elements so the chunks after
+// it know where their elements go in the combined arrays
+static void CountChunk(Chunk& chunk)
+{
+	const char* p = chunk.begin;
+
+	while ( p < chunk.end ) {
+
+		const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+		if ( lineEnd == nullptr )
+			lineEnd = chunk.end;
+
+		p = SkipSpace(p, lineEnd);
+
+		if ( lineEnd - p > 1 && p[0] == 'v' ) {
+			if ( IsSpace(p[1]) )
+				++chunk.numPositions;
+			else if ( p[1] == 't' && lineEnd - p > 2 && IsSpace(p[2]) )
+				++chunk.numTextureCoords;
+			else if ( p[1] == 'n' && lineEnd - p > 2 && IsSpace(p[2]) )
+				++chunk.numNormals;
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+static void ParseChunk(Chunk& chunk, Vec3* positions, Vec2* textureCoords, Vec3* normals)
+{
+	int positionCount = chunk.firstPosition;
+	int textureCoordCount = chunk.firstTextureCoord;
+	int normalCount = chunk.firstNormal;
+
+	std::vector<Corner> face;
+
+	const char* p = chunk.begin;
+
+	while ( p < chunk.end ) {
+
+		const char* lineEnd = (const char*)memchr(p, '\n', chunk.end - p);
+		if ( lineEnd == nullptr )
+			lineEnd = chunk.end;
+
+		p = SkipSpace(p, lineEnd);
+
+		if ( LineStartsWith(p, lineEnd, "v", 1) ) {
+
+			float values[6];
+			int numValues = 0;
+
+			const char* q = p + 1;
+			while ( numValues < 6 ) {
+
+				q = SkipSpace(q, lineEnd);
+
+				const char* next = ParseFloat(q, lineEnd, values[numValues]);
+				if ( next == nullptr )
+					break;
+
+				q = next;
+				++numValues;
+			}
+
+			if ( numValues < 3 ) {
+				chunk.valid = false;
+				return;
+			}
+
+			positions[positionCount] = { values[0], values[1], values[2] };
+
+			// x y z r g b is the common extension for colored scans
+			if ( numValues == 6 ) {
+				chunk.colors.resize(positionCount - chunk.firstPosition, Vec3(1, 1, 1));
+				chunk.colors.push_back({ values[3], values[4], values[5] });
+			}
+
+			++positionCount;
+		}
+		else if ( LineStartsWith(p, lineEnd, "vt", 2) ) {
+
+			float s = 0, t = 0;
+
+			const char* q = ParseFloat(SkipSpace(p + 2, lineEnd), lineEnd, s);
+			if ( q == nullptr ) {
+				chunk.valid = false;
+				return;
+			}
+			ParseFloat(SkipSpace(q, lineEnd), lineEnd, t);
+
+			// flip t so the origin is the top left of the texture
+			textureCoords[textureCoordCount++] = { s, 1 - t };
+		}
+		else if ( LineStartsWith(p, lineEnd, "vn", 2) ) {
+
+			float values[3];
+
+			const char* q = p + 2;
+			for ( int i = 0; i < 3; ++i ) {
+
+				q = ParseFloat(SkipSpace(q, lineEnd), lineEnd, values[i]);
+				if ( q == nullptr ) {
+					chunk.valid = false;
+					return;
+				}
+			}
+
+			normals[normalCount++] = { values[0], values[1], values[2] };
+		}
+		else if ( LineStartsWith(p, lineEnd, "f", 1) ) {
+
+			face.clear();
+
+			const char* q = SkipSpace(p + 1, lineEnd);
+			while ( q < lineEnd ) {
+
+				int index;
+				Corner corner = { MISSING_INDEX, MISSING_INDEX, MISSING_INDEX };
+
+				q = ParseInt(q, lineEnd, index);
+				if ( q == nullptr ) {
+					chunk.valid = false;
+					return;
+				}
+				corner.position = ResolveIndex(index, positionCount);
+
+				if ( q < lineEnd && *q == '/' ) {
+
+					++q;
+					if ( q < lineEnd && *q != '/' ) {
+
+						q = ParseInt(q, lineEnd, index);
+						if ( q == nullptr ) {
+							chunk.valid = false;
+							return;
+						}
+						corner.textureCoord = ResolveIndex(index, textureCoordCount);
+					}
+
+					if ( q < lineEnd && *q == '/' ) {
+
+						q = ParseInt(q + 1, lineEnd, index);
+						if ( q == nullptr ) {
+							chunk.valid = false;
+							return;
+						}
+						corner.normal = ResolveIndex(index, normalCount);
+					}
+				}
+
+				face.push_back(corner);
+				q = SkipSpace(q, lineEnd);
+			}
+
+			// fan out from the first corner, faces with fewer
+			// than three corners aren't surfaces and are skipped
+			for ( size_t i = 2; i < face.size(); ++i ) {
+				chunk.triangles.push_back(face[0]);
+				chunk.triangles.push_back(face[i - 1]);
+				chunk.triangles.push_back(face[i]);
+			}
+		}
+		else if ( LineStartsWith(p, lineEnd, "usemtl", 6) ) {
+
+			chunk.materialSwitches.push_back({ (int)chunk.triangles.size() / 3, RestOfLine(p + 6, lineEnd) });
+		}
+		else if ( LineStartsWith(p, lineEnd, "mtllib", 6) ) {
+
+			std::istringstream names(RestOfLine(p + 6, lineEnd));
+			std::string name;
+
+			while ( names >> name )
+				chunk.materialLibraries.push_back(name);
+		}
+
+		// comments, groups, objects, smoothing groups, lines and points are ignored
+		p = lineEnd + 1;
+	}
+
+	if ( !chunk.colors.empty() )
+		chunk.colors.resize(chunk.numPositions, Vec3(1, 1, 1));
+}
+
+
+/////// MATERIALS ////////
+
+static MaterialData DefaultMaterial()
+{
+	MaterialData material;
+
+	material.diffuse = { 0.6f, 0.6f, 0.6f };
+	material.ambient = { 0, 0, 0 };
+	material.specular = { 0, 0, 0 };
+	material.emissive = { 0, 0, 0 };
+	material.specularExponent = 0;
+
+	return material;
+}
+
+static void LoadMaterialLibrary(const std::string& filepath, std::vector<MaterialData>& materials, std::unordered_map<std::string, int>& materialIDs)
+{
+	std::ifstream file(filepath);
+	if ( !file ) {
+		std::cout << "Could not open material library " << filepath << std::endl;
+		return;
+	}
+
+	static const struct {
+		const char* keyword;
+		int texture;
+	} textureKeywords[] = {
+		{ "map_Ka", MaterialData::AMBIENT_TEXTURE },
+		{ "map_Kd", MaterialData::DIFFUSE_TEXTURE },
+		{ "map_Ks", MaterialData::SPECULAR_TEXTURE },
+		{ "map_Ke", MaterialData::EMISSIVE_TEXTURE },
+		{ "map_bump", MaterialData::HEIGHT_MAP },
+		{ "bump", MaterialData::HEIGHT_MAP },
+		{ "map_disp", MaterialData::HEIGHT_MAP },
+		{ "norm", MaterialData::NORMAL_MAP },
+		{ "map_Ns", MaterialData::GLOSS_MAP }
+	};
+
+	MaterialData* material = nullptr;
+	std::string line;
+
+	while ( std::getline(file, line) ) {
+
+		std::istringstream stream(line);
+		std::string keyword;
+
+		if ( !(stream >> keyword) )
+			continue;
+
+		if ( keyword == "newmtl" ) {
+
+			std::string name = RestOfLine(line.data() + line.find("newmtl") + 6, line.data() + line.size());
+
+			materialIDs[name] = (int)materials.size();
+			materials.push_back(DefaultMaterial());
+			material = &materials.back();
+			continue;
+		}
+
+		if ( material == nullptr )
+			continue;
+
+		Vec3* color = keyword == "Kd" ? &material->diffuse :
+			keyword == "Ka" ? &material->ambient :
+			keyword == "Ks" ? &material->specular :
+			keyword == "Ke" ? &material->emissive : nullptr;
+
+		if ( color != nullptr ) {
+			stream >> color->r >> color->g >> color->b;
+			continue;
+		}
+
+		if ( keyword == "Ns" ) {
+			stream >> material->specularExponent;
+			continue;
+		}
+
+		for ( const auto& textureKeyword : textureKeywords ) {
+
+			if ( keyword != textureKeyword.keyword )
+				continue;
+
+			// options like -bm 1.0 come before the file name, which is last
+			std::string path;
+			while ( stream >> path )
+				;
+
+			material->textures[textureKeyword.texture] = path;
+			break;
+		}
+	}
+}
+
+
+/////// MESHES ////////
+
+static inline unsigned int HashCorner(const Corner& corner)
+{
+	unsigned int hash = (unsigned int)corner.position * 0x9E3779B1u;
+	hash ^= (unsigned int)corner.textureCoord * 0x85EBCA77u + (hash << 6) + (hash >> 2);
+	hash ^= (unsigned int)corner.normal * 0xC2B2AE3Du + (hash << 6) + (hash >> 2);
+	return hash ^ (hash >> 15);
+}
+
+static inline bool SameCorner(const Corner& a, const Corner& b)
+{
+	return a.position == b.position && a.textureCoord == b.textureCoord && a.normal == b.normal;
+}
+
+// joins identical corners into vertices. Corners are inserted into an open
+// addressing table from every thread at once. Each slot holds the first
+// corner with that key, which keeps the vertex order the same as reading
+// the corners one by one, no matter how the threads interleave.
+static bool BuildMesh(const std::vector<Corner>& corners, const Vec3* positions, int numPositions, const Vec2* textureCoords, int numTextureCoords,
+	const Vec3* normals, int numNormals, const Vec3* colors, MeshArrays& mesh)
+{
+	ThreadPool& pool = ThreadPool::Global();
+
+	// the table has two slots per corner and slots are stored as ints,
+	// a mesh with more corners than that can't be joined
+	if ( corners.size() > INT_MAX / 2 ) {
+		std::cout << "OBJ mesh has too many corners, " << corners.size() << std::endl;
+		return false;
+	}
+
+	int numCorners = (int)corners.size();
+
+	std::atomic<bool> valid(true);
+	std::atomic<bool> hasTextureCoords(false);
+	std::atomic<bool> hasNormals(false);
+
+	pool.ParallelFor(numCorners, CORNER_GRAIN, [&](int begin, int end) {
+
+		bool anyTextureCoords = false, anyNormals = false;
+
+		for ( int i = begin; i < end; ++i ) {
+
+			const Corner& corner = corners[i];
+
+			bool hasTextureCoord = corner.textureCoord != MISSING_INDEX;
+			bool hasNormal = corner.normal != MISSING_INDEX;
+
+			if ( corner.position < 0 || corner.position >= numPositions ||
+				(hasTextureCoord && (corner.textureCoord < 0 || corner.textureCoord >= numTextureCoords)) ||
+				(hasNormal && (corner.normal < 0 || corner.normal >= numNormals)) ) {
+				valid = false;
+				return;
+			}
+
+			anyTextureCoords |= hasTextureCoord;
+			anyNormals |= hasNormal;
+		}
+
+		if ( anyTextureCoords )
+			hasTextureCoords = true;
+		if ( anyNormals )
+			hasNormals = true;
+	});
+
+	if ( !valid ) {
+		std::cout << "OBJ face refers to an element that doesn't exist" << std::endl;
+		return false;
+	}
+
+	size_t capacity = 16;
+	while ( capacity < (size_t)numCorners * 2 )
+		capacity *= 2;
+
+	unsigned int mask = (unsigned int)(capacity - 1);
+
+	std::unique_ptr<std::atomic<int>[]> table(new std::atomic<int>[capacity]);
+	pool.ParallelFor(capacity, (size_t)CORNER_GRAIN, [&](size_t begin, size_t end) {
+		for ( size_t i = begin; i < end; ++i )
+			table[i].store(-1, std::memory_order_relaxed);
+	});
+
+	// the slot of each corner's key, so it doesn't have to be found twice
+	std::vector<int> slots(numCorners);
+
+	pool.ParallelFor(numCorners, CORNER_GRAIN, [&](int begin, int end) {
+
+		for ( int i = begin; i < end; ++i ) {
+
+			const Corner& corner = corners[i];
+			unsigned int slot = HashCorner(corner) & mask;
+
+			while ( true ) {
+
+				int occupant = table[slot].load(std::memory_order_relaxed);
+
+				if ( occupant == -1 ) {
+					if ( table[slot].compare_exchange_weak(occupant, i) )
+						break;
+					if ( occupant == -1 )
+						continue;
+				}
+
+				// occupants of a slot only ever change to smaller
+				// corners with the same key, so this check holds
+				if ( SameCorner(corners[occupant], corner) ) {
+					while ( i < occupant && !table[slot].compare_exchange_weak(occupant, i) )
+						;
+					break;
+				}
+
+				slot = (slot + 1) & mask;
+			}
+
+			slots[i] = slot;
+		}
+	});
+
+	// number the first corner of each key in order, counting
+	// per range first and then offsetting each range
+	int numRanges = std::max((numCorners + CORNER_GRAIN - 1) / CORNER_GRAIN, 1);
+	std::vector<int> rangeOffsets(numRanges + 1, 0);
+
+	pool.ParallelFor(numCorners, CORNER_GRAIN, [&](int begin, int end) {
+
+		int count = 0;
+		for ( int i = begin; i < end; ++i )
+			count += table[slots[i]].load(std::memory_order_relaxed) == i;
+
+		rangeOffsets[begin / CORNER_GRAIN + 1] = count;
+	});
+
+	for ( int r = 0; r < numRanges; ++r )
+		rangeOffsets[r + 1] += rangeOffsets[r];
+
+	int numVertices = rangeOffsets[numRanges];
+
+	// vertex number of each first corner, the rest look theirs up
+	std::vector<int> vertexOf(numCorners);
+
+	mesh.indices.resize(numCorners);
+	mesh.positions.resize(numVertices);
+	if ( hasTextureCoords )
+		mesh.textureCoords.resize(numVertices);
+	if ( hasNormals )
+		mesh.normals.resize(numVertices);
+	if ( colors != nullptr )
+		mesh.colors.resize(numVertices);
+
+	pool.ParallelFor(numCorners, CORNER_GRAIN, [&](int begin, int end) {
+
+		int vertex = rangeOffsets[begin / CORNER_GRAIN];
+
+		for ( int i = begin; i < end; ++i ) {
+
+			if ( table[slots[i]].load(std::memory_order_relaxed) != i )
+				continue;
+
+			const Corner& corner = corners[i];
+			vertexOf[i] = vertex;
+
+			mesh.positions[vertex] = positions[corner.position];
+
+			if ( hasTextureCoords )
+				mesh.textureCoords[vertex] = corner.textureCoord == MISSING_INDEX ? Vec2(0, 0) : textureCoords[corner.textureCoord];
+			if ( hasNormals )
+				mesh.normals[vertex] = corner.normal == MISSING_INDEX ? Vec3(0, 0, 0) : normals[corner.normal];
+			if ( colors != nullptr )
+				mesh.colors[vertex] = colors[corner.position];
+
+			++vertex;
+		}
+	});
+
+	pool.ParallelFor(numCorners, CORNER_GRAIN, [&](int begin, int end) {
+		for ( int i = begin; i < end; ++i )
+			mesh.indices[i] = vertexOf[table[slots[i]].load(std::memory_order_relaxed)];
+	});
+
+	return true;
+}
+
+
+/////// LOADING ////////
+
+bool LoadObj(const std::string& filepath, std::vector<MeshArrays>& outMeshes, std::vector<MaterialData>& outMaterials)
+{
+	MappedFile file(filepath);
+	if ( !file.IsOpen() )
+		return false;
+
+	ThreadPool& pool = ThreadPool::Global();
+
+	const char* pFile = file.GetData();
+	const char* pEnd = pFile + file.GetSize();
+
+	// chunks end just after a newline, so no line is split between two
+	std::vector<Chunk> chunks;
+	for ( const char* p = pFile; p < pEnd; ) {
+
+		Chunk chunk;
+		chunk.begin = p;
+
+		if ( pEnd - p <= CHUNK_SIZE ) {
+			chunk.end = pEnd;
+		}
+		else {
+			const char* newline = (const char*)memchr(p + CHUNK_SIZE, '\n', pEnd - p - CHUNK_SIZE);
+			chunk.end = newline == nullptr ? pEnd : newline + 1;
+		}
+
+		p = chunk.end;
+		chunks.push_back(std::move(chunk));
+	}
+
+	int numChunks = (int)chunks.size();
+
+	pool.ParallelFor(numChunks, 1, [&](int begin, int end) {
+		for ( int c = begin; c < end; ++c )
+			CountChunk(chunks[c]);
+	});
+
+	int numPositions = 0, numTextureCoords = 0, numNormals = 0;
+	for ( Chunk& chunk : chunks ) {
+
+		chunk.firstPosition = numPositions;
+		chunk.firstTextureCoord = numTextureCoords;
+		chunk.firstNormal = numNormals;
+
+		numPositions += chunk.numPositions;
+		numTextureCoords += chunk.numTextureCoords;
+		numNormals += chunk.numNormals;
+	}
+
+	if ( numPositions == 0 )
+		return false;
+
+	// every chunk knows where its elements go, so they are
+	// parsed straight into the combined arrays
+	std::vector<Vec3> positions(numPositions);
+	std::vector<Vec2> textureCoords(numTextureCoords);
+	std::vector<Vec3> normals(numNormals);
+
+	pool.ParallelFor(numChunks, 1, [&](int begin, int end) {
+		for ( int c = begin; c < end; ++c )
+			ParseChunk(chunks[c], positions.data(), textureCoords.data(), normals.data());
+	});
+
+	std::vector<Vec3> colors;
+
+	for ( const Chunk& chunk : chunks ) {
+
+		if ( !chunk.valid ) {
+			std::cout << "Could not parse " << filepath << std::endl;
+			return false;
+		}
+
+		if ( !chunk.colors.empty() && colors.empty() )
+			colors.resize(numPositions, Vec3(1, 1, 1));
+
+		if ( !chunk.colors.empty() )
+			std::copy(chunk.colors.begin(), chunk.colors.end(), colors.begin() + chunk.firstPosition);
+	}
+
+	// material 0 is used by faces without a material, like Assimp does
+	std::vector<MaterialData> materials(1, DefaultMaterial());
+	std::unordered_map<std::string, int> materialIDs;
+
+	std::string directory = filepath.substr(0, filepath.find_last_of("/") + 1);
+
+	for ( const Chunk& chunk : chunks )
+		for ( const std::string& library : chunk.materialLibraries )
+			LoadMaterialLibrary(directory + library, materials, materialIDs);
+
+	// split the triangles into runs by material, the material at
+	// the start of a chunk is the last one set before it
+	std::vector<std::vector<Segment>> segmentsByMaterial(materials.size());
+	int currentMaterial = 0;
+
+	for ( int c = 0; c < numChunks; ++c ) {
+
+		const Chunk& chunk = chunks[c];
+		int numTriangles = (int)chunk.triangles.size() / 3;
+		int runStart = 0;
+
+		for ( size_t s = 0; s <= chunk.materialSwitches.size(); ++s ) {
+
+			int runEnd = s < chunk.materialSwitches.size() ? chunk.materialSwitches[s].triangle : numTriangles;
+
+			if ( runEnd > runStart )
+				segmentsByMaterial[currentMaterial].push_back({ c, runStart, runEnd });
+
+			if ( s < chunk.materialSwitches.size() ) {
+
+				auto found = materialIDs.find(chunk.materialSwitches[s].name);
+				currentMaterial = found == materialIDs.end() ? 0 : found->second;
+				runStart = runEnd;
+			}
+		}
+	}
+
+	std::vector<MeshArrays> meshes;
+
+	for ( int m = 0; m < (int)materials.size(); ++m ) {
+
+		const std::vector<Segment>& segments = segmentsByMaterial[m];
+		if ( segments.empty() )
+			continue;
+
+		std::vector<int> segmentStarts(segments.size() + 1, 0);
+		for ( size_t s = 0; s < segments.size(); ++s )
+			segmentStarts[s + 1] = segmentStarts[s] + (segments[s].end - segments[s].begin) * 3;
+
+		std::vector<Corner> corners(segmentStarts.back());
+
+		pool.ParallelFor((int)segments.size(), 1, [&](int begin, int end) {
+
+			for ( int s = begin; s < end; ++s ) {
+
+				const Segment& segment = segments[s];
+				const Corner* source = chunks[segment.chunk].triangles.data();
+
+				std::copy(source + segment.begin * 3, source + segment.end * 3, corners.begin() + segmentStarts[s]);
+			}
+		});
+
+		meshes.emplace_back();
+		meshes.back().materialID = m;
+
+		if ( !BuildMesh(corners, positions.data(), numPositions, textureCoords.data(), numTextureCoords,
+			normals.data(), numNormals, colors.empty() ? nullptr : colors.data(), meshes.back()) ) {
+			return false;
+		}
+	}
+
+	outMeshes = std::move(meshes);
+	outMaterials = std::move(materials);
+	return true;
+}
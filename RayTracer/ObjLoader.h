@@ -0,0 +1,12 @@
+#pragma once
+#include "Importing.h"
+
+// Reads Wavefront OBJ files without Assimp. The file is mapped into memory,
+// split into chunks at line boundaries and parsed on every thread of the
+// pool. Faces are triangulated as fans, split into one mesh per material,
+// and corners with the same position/texture/normal indices are joined
+// into one vertex, the same as Assimp's JoinIdenticalVertices.
+//
+// Returns false if the file can't be read or is malformed, the scene
+// falls back to Assimp in that case.
+bool LoadObj(const std::string& filepath, std::vector<MeshArrays>& outMeshes, std::vector<MaterialData>& outMaterials);
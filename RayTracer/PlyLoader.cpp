@@ -0,0 +1,549 @@
+#include "PlyLoader.h"
+
+#include <fstream>
+#include <cstring>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <climits>
+
+// bytes read from the file at a time
+#define STREAM_BUFFER_SIZE (4 << 20)
+
+enum PropertyType {
+	TYPE_INT8,
+	TYPE_UINT8,
+	TYPE_INT16,
+	TYPE_UINT16,
+	TYPE_INT32,
+	TYPE_UINT32,
+	TYPE_FLOAT32,
+	TYPE_FLOAT64,
+	TYPE_INVALID
+};
+
+static const int typeSizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+// what a vertex property is decoded into
+enum PropertyTarget {
+	TARGET_NONE,
+	TARGET_POSITION,
+	TARGET_NORMAL,
+	TARGET_COLOR,
+	TARGET_TEXTURE_COORD
+};
+
+struct Property {
+
+	std::string name;
+	PropertyType type;
+
+	// only for lists
+	bool isList;
+	PropertyType countType;
+
+	PropertyTarget target;
+	int component;
+
+};
+
+struct Element {
+
+	std::string name;
+	long long count;
+	std::vector<Property> properties;
+
+	// size of one record, -1 if it has lists
+	int recordSize;
+
+};
+
+static PropertyType ParseType(const std::string& name)
+{
+	if ( name == "char" || name == "int8" )
+		return TYPE_INT8;
+	if ( name == "uchar" || name == "uint8" )
+		return TYPE_UINT8;
+	if ( name == "short" || name == "int16" )
+		return TYPE_INT16;
+	if ( name == "ushort" || name == "uint16" )
+		return TYPE_UINT16;
+	if ( name == "int" || name == "int32" )
+		return TYPE_INT32;
+	if ( name == "uint" || name == "uint32" )
+		return TYPE_UINT32;
+	if ( name == "float" || name == "float32" )
+		return TYPE_FLOAT32;
+	if ( name == "double" || name == "float64" )
+		return TYPE_FLOAT64;
+	return TYPE_INVALID;
+}
+
+template <class T>
+static inline T ReadValue(const unsigned char* p)
+{
+	T value;
+	memcpy(&value, p, sizeof(T));
+	return value;
+}
+
+static inline double ReadAsDouble(const unsigned char* p, PropertyType type)
+{
+	switch ( type ) {
+	case TYPE_INT8:    return ReadValue<signed char>(p);
+	case TYPE_UINT8:   return ReadValue<unsigned char>(p);
+	case TYPE_INT16:   return ReadValue<short>(p);
+	case TYPE_UINT16:  return ReadValue<unsigned short>(p);
+	case TYPE_INT32:   return ReadValue<int>(p);
+	case TYPE_UINT32:  return ReadValue<unsigned int>(p);
+	case TYPE_FLOAT32: return ReadValue<float>(p);
+	case TYPE_FLOAT64: return ReadValue<double>(p);
+	default:           return 0;
+	}
+}
+
+static inline long long ReadAsInteger(const unsigned char* p, PropertyType type)
+{
+	switch ( type ) {
+	case TYPE_INT8:    return ReadValue<signed char>(p);
+	case TYPE_UINT8:   return ReadValue<unsigned char>(p);
+	case TYPE_INT16:   return ReadValue<short>(p);
+	case TYPE_UINT16:  return ReadValue<unsigned short>(p);
+	case TYPE_INT32:   return ReadValue<int>(p);
+	case TYPE_UINT32:  return ReadValue<unsigned int>(p);
+	case TYPE_FLOAT32: return (long long)ReadValue<float>(p);
+	case TYPE_FLOAT64: return (long long)ReadValue<double>(p);
+	default:           return 0;
+	}
+}
+
+static void AssignTarget(Property& property)
+{
+	static const struct {
+		const char* name;
+		PropertyTarget target;
+		int component;
+	} targets[] = {
+		{ "x", TARGET_POSITION, 0 }, { "y", TARGET_POSITION, 1 }, { "z", TARGET_POSITION, 2 },
+		{ "nx", TARGET_NORMAL, 0 }, { "ny", TARGET_NORMAL, 1 }, { "nz", TARGET_NORMAL, 2 },
+		{ "red", TARGET_COLOR, 0 }, { "green", TARGET_COLOR, 1 }, { "blue", TARGET_COLOR, 2 },
+		{ "r", TARGET_COLOR, 0 }, { "g", TARGET_COLOR, 1 }, { "b", TARGET_COLOR, 2 },
+		{ "u", TARGET_TEXTURE_COORD, 0 }, { "v", TARGET_TEXTURE_COORD, 1 },
+		{ "s", TARGET_TEXTURE_COORD, 0 }, { "t", TARGET_TEXTURE_COORD, 1 },
+		{ "texture_u", TARGET_TEXTURE_COORD, 0 }, { "texture_v", TARGET_TEXTURE_COORD, 1 }
+	};
+
+	property.target = TARGET_NONE;
+	property.component = 0;
+
+	if ( property.isList )
+		return;
+
+	for ( const auto& target : targets ) {
+		if ( property.name == target.name ) {
+			property.target = target.target;
+			property.component = target.component;
+			return;
+		}
+	}
+}
+
+// the header is text, terminated by end_header and a newline
+static bool ReadHeader(std::ifstream& file, std::vector<Element>& elements)
+{
+	std::string line;
+
+	if ( !std::getline(file, line) || line.compare(0, 3, "ply") != 0 )
+		return false;
+
+	bool littleEndian = false;
+
+	while ( std::getline(file, line) ) {
+
+		std::istringstream stream(line);
+		std::string keyword;
+		stream >> keyword;
+
+		if ( keyword == "format" ) {
+
+			std::string format;
+			stream >> format;
+			littleEndian = format == "binary_little_endian";
+		}
+		else if ( keyword == "element" ) {
+
+			Element element;
+			stream >> element.name >> element.count;
+
+			if ( !stream || element.count < 0 )
+				return false;
+
+			element.recordSize = 0;
+			elements.push_back(element);
+		}
+		else if ( keyword == "property" ) {
+
+			if ( elements.empty() )
+				return false;
+
+			Element& element = elements.back();
+			Property property;
+
+			std::string type;
+			stream >> type;
+
+			property.isList = type == "list";
+
+			if ( property.isList ) {
+
+				std::string countType;
+				stream >> countType >> type;
+
+				property.countType = ParseType(countType);
+				if ( property.countType == TYPE_INVALID || property.countType >= TYPE_FLOAT32 )
+					return false;
+
+				element.recordSize = -1;
+			}
+
+			property.type = ParseType(type);
+			stream >> property.name;
+
+			if ( property.type == TYPE_INVALID || !stream )
+				return false;
+
+			if ( element.recordSize >= 0 )
+				element.recordSize += typeSizes[property.type];
+
+			AssignTarget(property);
+			element.properties.push_back(property);
+		}
+		else if ( keyword == "end_header" ) {
+
+			return littleEndian;
+		}
+	}
+
+	return false;
+}
+
+static bool IsIndexList(const Property& property)
+{
+	return property.isList && (property.name == "vertex_indices" || property.name == "vertex_index");
+}
+
+// the smallest a record can be, with every list empty
+static long long MinimumRecordSize(const Element& element)
+{
+	long long size = 0;
+	for ( const Property& property : element.properties )
+		size += typeSizes[property.isList ? property.countType : property.type];
+	return size;
+}
+
+// a window over the file. Records are decoded from the buffer, and
+// once fewer bytes than a record are left, the rest is moved to the
+// front and the buffer is filled again
+class StreamReader {
+
+private:
+
+	std::ifstream& file;
+	std::vector<unsigned char> buffer;
+
+	size_t position = 0;
+	size_t available = 0;
+
+public:
+
+	long long bytesRead = 0;
+
+	StreamReader(std::ifstream& file)
+		:
+		file(file), buffer(STREAM_BUFFER_SIZE)
+	{
+	}
+
+	// makes sure size bytes can be read at Data()
+	bool Require(size_t size)
+	{
+		if ( available - position >= size )
+			return true;
+
+		if ( size > buffer.size() )
+			return false;
+
+		size_t remaining = available - position;
+		memmove(buffer.data(), buffer.data() + position, remaining);
+
+		file.read((char*)buffer.data() + remaining, buffer.size() - remaining);
+		size_t read = (size_t)file.gcount();
+		bytesRead += read;
+
+		position = 0;
+		available = remaining + read;
+
+		return available >= size;
+	}
+
+	const unsigned char* Data() const
+	{
+		return buffer.data() + position;
+	}
+
+	void Advance(size_t size)
+	{
+		position += size;
+	}
+
+	// bytes of the file that were read and moved past
+	long long Consumed() const
+	{
+		return bytesRead - (long long)(available - position);
+	}
+
+};
+
+static bool ReadVertices(StreamReader& reader, const Element& element, MeshArrays& mesh)
+{
+	bool hasNormals = false, hasColors = false, hasTextureCoords = false;
+
+	for ( const Property& property : element.properties ) {
+
+		if ( property.isList )
+			return false;
+
+		hasNormals |= property.target == TARGET_NORMAL;
+		hasColors |= property.target == TARGET_COLOR;
+		hasTextureCoords |= property.target == TARGET_TEXTURE_COORD;
+	}
+
+	if ( element.count > INT_MAX )
+		return false;
+
+	mesh.positions.resize(element.count);
+	if ( hasNormals )
+		mesh.normals.resize(element.count);
+	if ( hasColors )
+		mesh.colors.resize(element.count);
+	if ( hasTextureCoords )
+		mesh.textureCoords.resize(element.count);
+
+	// 8 bit colors go from 0 to 255, others are assumed to be 0 to 1
+	std::vector<float> scales;
+	for ( const Property& property : element.properties )
+		scales.push_back(property.target == TARGET_COLOR && property.type == TYPE_UINT8 ? 1.0f / 255 : 1.0f);
+
+	for ( long long v = 0; v < element.count; ++v ) {
+
+		if ( !reader.Require(element.recordSize) )
+			return false;
+
+		const unsigned char* p = reader.Data();
+
+		for ( size_t i = 0; i < element.properties.size(); ++i ) {
+
+			const Property& property = element.properties[i];
+
+			if ( property.target != TARGET_NONE ) {
+
+				float value = (property.type == TYPE_FLOAT32 ? ReadValue<float>(p) : (float)ReadAsDouble(p, property.type)) * scales[i];
+
+				switch ( property.target ) {
+				case TARGET_POSITION:      (&mesh.positions[v].x)[property.component] = value; break;
+				case TARGET_NORMAL:        (&mesh.normals[v].x)[property.component] = value; break;
+				case TARGET_COLOR:         (&mesh.colors[v].x)[property.component] = value; break;
+				case TARGET_TEXTURE_COORD: (&mesh.textureCoords[v].x)[property.component] = value; break;
+				default: break;
+				}
+			}
+
+			p += typeSizes[property.type];
+		}
+
+		reader.Advance(element.recordSize);
+	}
+
+	// flip t so the origin is the top left of the texture
+	for ( Vec2& textureCoord : mesh.textureCoords )
+		textureCoord.t = 1 - textureCoord.t;
+
+	return true;
+}
+
+static bool ReadFaces(StreamReader& reader, const Element& element, int numVertices, long long bytesLeft, MeshArrays& mesh)
+{
+	// most scans are all triangles, anything else grows the array as it goes.
+	// No more triangles are reserved than the rest of the file can hold
+	long long triangleSize = 0;
+	for ( const Property& property : element.properties ) {
+		if ( IsIndexList(property) )
+			triangleSize += typeSizes[property.countType] + 3 * typeSizes[property.type];
+		else
+			triangleSize += typeSizes[property.isList ? property.countType : property.type];
+	}
+
+	if ( triangleSize > 0 )
+		mesh.indices.reserve((size_t)std::min(element.count, bytesLeft / triangleSize) * 3);
+
+	int polygon[256];
+
+	for ( long long f = 0; f < element.count; ++f ) {
+
+		for ( const Property& property : element.properties ) {
+
+			if ( !property.isList ) {
+
+				if ( !reader.Require(typeSizes[property.type]) )
+					return false;
+
+				reader.Advance(typeSizes[property.type]);
+				continue;
+			}
+
+			int countSize = typeSizes[property.countType];
+			if ( !reader.Require(countSize) )
+				return false;
+
+			long long count = ReadAsInteger(reader.Data(), property.countType);
+			reader.Advance(countSize);
+
+			int indexSize = typeSizes[property.type];
+			if ( count < 0 || !reader.Require(count * indexSize) )
+				return false;
+
+			if ( IsIndexList(property) ) {
+
+				if ( count > 256 )
+					return false;
+
+				const unsigned char* p = reader.Data();
+				for ( int i = 0; i < count; ++i, p += indexSize ) {
+
+					long long index = property.type == TYPE_INT32 || property.type == TYPE_UINT32 ?
+						(long long)ReadValue<unsigned int>(p) : ReadAsInteger(p, property.type);
+
+					if ( index < 0 || index >= numVertices )
+						return false;
+
+					polygon[i] = (int)index;
+				}
+
+				for ( int i = 2; i < count; ++i ) {
+					mesh.indices.push_back(polygon[0]);
+					mesh.indices.push_back(polygon[i - 1]);
+					mesh.indices.push_back(polygon[i]);
+				}
+			}
+
+			reader.Advance(count * indexSize);
+		}
+	}
+
+	return true;
+}
+
+static bool SkipElement(StreamReader& reader, const Element& element)
+{
+	for ( long long r = 0; r < element.count; ++r ) {
+
+		for ( const Property& property : element.properties ) {
+
+			long long count = 1;
+
+			if ( property.isList ) {
+
+				if ( !reader.Require(typeSizes[property.countType]) )
+					return false;
+
+				count = ReadAsInteger(reader.Data(), property.countType);
+				reader.Advance(typeSizes[property.countType]);
+			}
+
+			if ( count < 0 || !reader.Require(count * typeSizes[property.type]) )
+				return false;
+
+			reader.Advance(count * typeSizes[property.type]);
+		}
+	}
+
+	return true;
+}
+
+bool LoadPly(const std::string& filepath, std::vector<MeshArrays>& outMeshes, std::vector<MaterialData>& outMaterials)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+	if ( !file )
+		return false;
+
+	long long fileSize = file.tellg();
+	file.seekg(0);
+
+	std::vector<Element> elements;
+	if ( !ReadHeader(file, elements) )
+		return false;
+
+	long long headerSize = file.tellg();
+
+	StreamReader reader(file);
+
+	MeshArrays mesh;
+	mesh.materialID = 0;
+
+	bool valid = true;
+	bool hasVertices = false;
+
+	// elements are stored one after the other in the order of the header,
+	// faces can only refer to vertices if those come first
+	for ( const Element& element : elements ) {
+
+		// the counts come from the header, anything the rest of the file can't
+		// hold is a damaged file. Checked before the arrays are allocated
+		long long bytesLeft = fileSize - headerSize - reader.Consumed();
+		long long recordSize = MinimumRecordSize(element);
+
+		if ( element.count > 0 && (recordSize == 0 || element.count > bytesLeft / recordSize) ) {
+			valid = false;
+			break;
+		}
+
+		if ( element.name == "vertex" && !hasVertices ) {
+			valid = ReadVertices(reader, element, mesh);
+			hasVertices = true;
+		}
+		else if ( element.name == "face" && hasVertices ) {
+			valid = ReadFaces(reader, element, (int)mesh.positions.size(), bytesLeft, mesh);
+		}
+		else {
+			valid = SkipElement(reader, element);
+		}
+
+		if ( !valid )
+			break;
+	}
+
+	if ( !valid || !hasVertices ) {
+		std::cout << "Could not read binary PLY " << filepath << std::endl;
+		return false;
+	}
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double megabytes = (headerSize + reader.bytesRead) / (1024.0 * 1024.0);
+
+	std::cout << "Read " << filepath << ": " << megabytes << " MB in " << seconds * 1000 << " ms (" << megabytes / seconds << " MB/s)" << std::endl;
+
+	MaterialData material;
+	material.diffuse = { 0.6f, 0.6f, 0.6f };
+	material.ambient = { 0, 0, 0 };
+	material.specular = { 0, 0, 0 };
+	material.emissive = { 0, 0, 0 };
+	material.specularExponent = 0;
+
+	outMeshes.clear();
+	outMeshes.push_back(std::move(mesh));
+	outMaterials.assign(1, material);
+
+	return true;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include "Importing.h"
+
+// Reads binary little endian PLY files without Assimp. The file is streamed
+// through a fixed size buffer in one pass, vertices and faces are decoded
+// straight into the mesh arrays, so the only memory used on top of the
+// mesh itself is the buffer. Polygons are triangulated as fans.
+//
+// Returns false for ASCII or big endian files and for anything malformed,
+// the scene falls back to Assimp in that case.
+bool LoadPly(const std::string& filepath, std::vector<MeshArrays>& outMeshes, std::vector<MaterialData>& outMaterials);
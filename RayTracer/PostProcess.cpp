@@ -0,0 +1,136 @@
+#include "PostProcess.h"
+#include "ThreadPool.h"
+#include <math.h>
+
+// pixels per task, a few pages of them
+#define POST_PROCESS_GRAIN (1 << 14)
+
+// blend mask that keeps alpha, which is the
+// fourth channel, from the original color
+#define KEEP_ALPHA 0x8
+
+PostProcess& PostProcess::Affine(__m128 scale, __m128 offset)
+{
+	// (x * s1 + o1) * s2 + o2 = x * (s1 * s2) + (o1 * s2 + o2)
+	if ( !operations.empty() && operations.back().type == AFFINE ) {
+
+		Operation& last = operations.back();
+		last.offset = _mm_add_ps(_mm_mul_ps(last.offset, scale), offset);
+		last.scale = _mm_mul_ps(last.scale, scale);
+
+		return *this;
+	}
+
+	operations.push_back({ AFFINE, scale, offset });
+	return *this;
+}
+
+PostProcess& PostProcess::Exposure(float stops)
+{
+	float scale = powf(2, stops);
+	return Affine(_mm_setr_ps(scale, scale, scale, 1), _mm_setzero_ps());
+}
+
+PostProcess& PostProcess::ToneMap()
+{
+	operations.push_back({ TONE_MAP, _mm_setzero_ps(), _mm_setzero_ps() });
+	return *this;
+}
+
+PostProcess& PostProcess::Gamma(float gamma)
+{
+	if ( gamma <= 0 )
+		return *this;
+
+	operations.push_back({ GAMMA, _mm_set1_ps(1 / gamma), _mm_setzero_ps() });
+	return *this;
+}
+
+PostProcess& PostProcess::Contrast(float contrast)
+{
+	// (x - 0.5) * (1 + contrast) + 0.5
+	float scale = 1 + contrast;
+	float offset = 0.5f - 0.5f * scale;
+
+	Affine(_mm_setr_ps(scale, scale, scale, 1), _mm_setr_ps(offset, offset, offset, 0));
+
+	operations.push_back({ CLAMP, _mm_setzero_ps(), _mm_setzero_ps() });
+	return *this;
+}
+
+PostProcess& PostProcess::Tint(const Vec4& target, float alpha)
+{
+	if ( alpha < 0 )
+		alpha = 0;
+	if ( alpha > 1 )
+		alpha = 1;
+
+	// x * (1 - alpha) + target * alpha, for all four channels
+	return Affine(_mm_set1_ps(1 - alpha), _mm_mul_ps(_mm_setr_ps(target.r, target.g, target.b, target.a), _mm_set1_ps(alpha)));
+}
+
+PostProcess& PostProcess::Invert()
+{
+	return Affine(_mm_setr_ps(-1, -1, -1, 1), _mm_setr_ps(1, 1, 1, 0));
+}
+
+void PostProcess::Apply(Surface& surface) const
+{
+	if ( surface.pPixels == nullptr )
+		return;
+
+	// every operation works per pixel, so the layout doesn't matter
+	int numPixels = surface.GetBufferSize() / sizeof(int);
+	int* pPixels = surface.pPixels;
+
+	const Operation* pOperations = operations.data();
+	int numOperations = (int)operations.size();
+
+	ThreadPool::Global().ParallelFor(numPixels, POST_PROCESS_GRAIN, [&](int begin, int end) {
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1);
+
+		for ( int i = begin; i < end; ++i ) {
+
+			__m128 color = surface.DecodePixel(pPixels[i]);
+
+			for ( int o = 0; o < numOperations; ++o ) {
+
+				const Operation& operation = pOperations[o];
+
+				switch ( operation.type ) {
+
+				case AFFINE:
+					color = _mm_add_ps(_mm_mul_ps(color, operation.scale), operation.offset);
+					break;
+
+				case CLAMP:
+					color = _mm_min_ps(_mm_max_ps(color, zero), one);
+					break;
+
+				case GAMMA:
+					color = _mm_blend_ps(_mm_pow_ps(_mm_max_ps(color, zero), operation.scale), color, KEEP_ALPHA);
+					break;
+
+				case TONE_MAP: {
+
+					// x (2.51 x + 0.03) / (x (2.43 x + 0.59) + 0.14)
+					__m128 x = _mm_max_ps(color, zero);
+					__m128 numerator = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+					__m128 denominator = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+
+					color = _mm_blend_ps(_mm_div_ps(numerator, denominator), color, KEEP_ALPHA);
+					break;
+				}
+
+				}
+			}
+
+			pPixels[i] = Surface::EncodePixel(color);
+		}
+
+	});
+
+	surface.UpdateTexels();
+}
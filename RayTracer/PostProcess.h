@@ -0,0 +1,63 @@
+#pragma once
+#include "Surface.h"
+#include "Vec4.h"
+#include <vector>
+#include <immintrin.h>
+
+// A chain of per pixel operations applied to a Surface in one pass. Each
+// pixel is read once, goes through every operation in an SSE register and
+// is written once, and the pixels are spread across the thread pool.
+// Operations that are linear in the color, like exposure, contrast, tint
+// and invert, are folded together when they are added.
+//
+// Colors are only clamped to [0, 1] when they are written, and by
+// Contrast, the same as Surface::SetContrast, so values above 1 from
+// Exposure reach ToneMap intact.
+//
+//     PostProcess().Exposure(1).ToneMap().Gamma(2.2f).Apply(surface);
+
+class PostProcess
+{
+private:
+	enum {
+		AFFINE,
+		CLAMP,
+		GAMMA,
+		TONE_MAP
+	};
+
+	struct Operation {
+
+		int type;
+
+		// color * scale + offset for AFFINE, the exponent for GAMMA
+		__m128 scale;
+		__m128 offset;
+
+	};
+
+	std::vector<Operation> operations;
+
+	PostProcess& Affine(__m128 scale, __m128 offset);
+
+public:
+	// multiplies the color by 2 ^ stops
+	PostProcess& Exposure(float stops);
+
+	// filmic curve from high dynamic range to [0, 1]
+	// "ACES Filmic Tone Mapping Curve", Narkowicz
+	PostProcess& ToneMap();
+
+	// raises the color to 1 / gamma
+	PostProcess& Gamma(float gamma);
+
+	// these match the Surface functions with the same names
+	PostProcess& Contrast(float contrast);
+	PostProcess& Tint(const Vec4& target, float alpha);
+	PostProcess& Invert();
+
+	// the operations in the order they were added. Only
+	// the surface itself is changed, not its mip maps
+	void Apply(Surface& surface) const;
+
+};
@@ -0,0 +1,276 @@
+#include "Regression.h"
+#include "IrradianceSH.h"
+#include "EnvironmentSampler.h"
+#include "Sampling.h"
+#include <functional>
+#include <memory>
+#include <fstream>
+#include <math.h>
+#include <limits>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// largest error allowed in the analytic checks, the
+// cube maps are only made of so many texels
+#define SKY_LIGHT_TOLERANCE 0.01f
+
+// relative errors allowed in the environment sampler check. Rounding
+// can move a sampled direction into the next texel, whose solid angle
+// differs by less than this, and both estimates are noisy
+#define PDF_TOLERANCE 0.01
+#define ESTIMATE_TOLERANCE 0.02
+
+namespace Regression {
+
+	// a cube map with every texel colored by its direction, and its
+	// mip maps, for comparing against results worked out by hand
+	static void MakeCubeMap(int size, const std::function<Vec4(const Vec3&)>& color, std::unique_ptr<Surface> faces[6], const Surface* planes[6]) {
+
+		for ( int f = 0; f < 6; ++f ) {
+
+			faces[f].reset(new Surface(size, size));
+
+			for ( int y = 0; y < size; ++y ) {
+				for ( int x = 0; x < size; ++x ) {
+					Vec3 dir = CubeMapDirection(f, { (x + 0.5f) / size, (y + 0.5f) / size }).Normalized();
+					faces[f]->PutPixel(x, y, color(dir));
+				}
+			}
+
+			faces[f]->GenerateMipMaps();
+			planes[f] = faces[f].get();
+		}
+
+	}
+
+	unsigned long long HashSurface(const Surface& surface) {
+
+		// 64 bit FNV-1a over the dimensions and every pixel
+		unsigned long long hash = 14695981039346656037ull;
+
+		auto hashInt = [&hash](unsigned int value) {
+			for ( int i = 0; i < 4; ++i ) {
+				hash ^= (value >> (i * 8)) & 0xff;
+				hash *= 1099511628211ull;
+			}
+		};
+
+		hashInt(surface.GetWidth());
+		hashInt(surface.GetHeight());
+
+		const int* pixels = surface.GetPixels();
+		for ( int i = 0; i < surface.GetWidth() * surface.GetHeight(); ++i )
+			hashInt(pixels[i]);
+
+		return hash;
+
+	}
+
+	ImageDifference Compare(const Surface& surface, const Surface& reference) {
+
+		ImageDifference diff = { 255, 0 };
+
+		if ( surface.GetWidth() != reference.GetWidth() || surface.GetHeight() != reference.GetHeight() )
+			return diff;
+
+		diff.maxError = 0;
+		double sumSquares = 0;
+
+		int numPixels = surface.GetWidth() * surface.GetHeight();
+
+		for ( int i = 0; i < numPixels; ++i ) {
+
+			int p1 = surface.GetPixels()[i];
+			int p2 = reference.GetPixels()[i];
+
+			// red, green and blue are the low three bytes
+			for ( int c = 0; c < 3; ++c ) {
+
+				int error = abs(((p1 >> (c * 8)) & 0xff) - ((p2 >> (c * 8)) & 0xff));
+
+				if ( error > diff.maxError )
+					diff.maxError = error;
+
+				sumSquares += error * error;
+			}
+		}
+
+		double mse = sumSquares / (numPixels * 3.0);
+
+		diff.psnr = mse == 0 ? std::numeric_limits<double>::infinity() : 10 * log10(255.0 * 255.0 / mse);
+
+		return diff;
+
+	}
+
+	bool RunCase(const std::string& name, RenderCase renderCase, int width, int height,
+		const std::vector<int>& threadCounts, const std::string& referenceDir, int maxErrorTolerance, double minPSNR) {
+
+		std::cout << "Regression case " << name << std::endl;
+
+		Surface first(width, height);
+		unsigned long long firstHash = 0;
+
+		bool passed = true;
+
+		// every thread count must produce exactly the same image
+		for ( size_t i = 0; i < threadCounts.size(); ++i ) {
+
+			Renderer renderer;
+			renderer.SetThreadCount(threadCounts[i]);
+
+			Surface target(width, height);
+			renderCase(renderer, target);
+
+			unsigned long long hash = HashSurface(target);
+			std::cout << "  " << threadCounts[i] << " threads: " << std::hex << hash << std::dec << std::endl;
+
+			if ( i == 0 ) {
+				first = target;
+				firstHash = hash;
+			}
+			else if ( hash != firstHash ) {
+				std::cout << "  FAILED: image depends on the thread count" << std::endl;
+				passed = false;
+			}
+		}
+
+		std::string referencePath = referenceDir + "/" + name + ".bmp";
+
+		if ( !std::ifstream(referencePath) ) {
+
+			std::cout << "  no reference, saving " << referencePath << std::endl;
+
+			// the directory may not exist yet, if it does this fails harmlessly
+#ifdef _WIN32
+			_mkdir(referenceDir.c_str());
+#else
+			mkdir(referenceDir.c_str(), 0755);
+#endif
+
+			// without a reference nothing was compared, so that can't pass
+			if ( !first.SaveToFile(referencePath) ) {
+				std::cout << "  FAILED: the reference could not be saved" << std::endl;
+				return false;
+			}
+
+			return passed;
+		}
+
+		Surface reference(referencePath);
+		ImageDifference diff = Compare(first, reference);
+
+		std::cout << "  max error " << diff.maxError << ", PSNR " << diff.psnr << " dB" << std::endl;
+
+		if ( diff.maxError > maxErrorTolerance || diff.psnr < minPSNR ) {
+			std::cout << "  FAILED: image differs from the reference" << std::endl;
+			passed = false;
+		}
+
+		return passed;
+
+	}
+
+	bool CheckSkyLight() {
+
+		std::cout << "Sky light check" << std::endl;
+
+		bool passed = true;
+
+		auto check = [&passed](const char* name, const Vec3& irradiance, float expected) {
+
+			float error = std::max(fabsf(irradiance.r - expected), std::max(fabsf(irradiance.g - expected), fabsf(irradiance.b - expected)));
+			std::cout << "  " << name << ": " << irradiance << ", expected " << expected << std::endl;
+
+			if ( error > SKY_LIGHT_TOLERANCE ) {
+				std::cout << "  FAILED: off by " << error << std::endl;
+				passed = false;
+			}
+		};
+
+		std::unique_ptr<Surface> faces[6];
+		const Surface* planes[6];
+
+		MakeCubeMap(64, [](const Vec3& dir) { return Vec4(1, 1, 1, 1); }, faces, planes);
+		IrradianceSH uniform(planes);
+
+		check("uniform, facing up", uniform.Irradiance({ 0, 1, 0 }), 1);
+		check("uniform, tilted", uniform.Irradiance({ 0.6f, 0.8f, 0 }), 1);
+
+		// the clamped cosine lobe of a wall sees half of the sky
+		MakeCubeMap(64, [](const Vec3& dir) { return dir.y > 0 ? Vec4(1, 1, 1, 1) : Vec4(0, 0, 0, 1); }, faces, planes);
+		IrradianceSH hemisphere(planes);
+
+		check("hemisphere, facing up", hemisphere.Irradiance({ 0, 1, 0 }), 1);
+		check("hemisphere, facing down", hemisphere.Irradiance({ 0, -1, 0 }), 0);
+		check("hemisphere, sideways", hemisphere.Irradiance({ 1, 0, 0 }), 0.5f);
+
+		return passed;
+
+	}
+
+	bool CheckEnvironmentSampler(int numSamples) {
+
+		std::cout << "Environment sampler check" << std::endl;
+
+		// most of the light comes from a cap a few degrees
+		// wide, where uniform sampling rarely looks
+		std::unique_ptr<Surface> faces[6];
+		const Surface* planes[6];
+
+		MakeCubeMap(256, [](const Vec3& dir) { return dir.y > 0.95f ? Vec4(1, 1, 1, 1) : Vec4(0.05f, 0.05f, 0.05f, 1); }, faces, planes);
+		EnvironmentSampler environmentSampler(planes);
+
+		double worstPdfError = 0;
+		double importanceEstimate = 0;
+		double uniformEstimate = 0;
+
+		for ( int i = 0; i < numSamples; ++i ) {
+
+			Sampler sampler(i, 0, 0);
+
+			float pdf;
+			Vec3 dir = environmentSampler.Sample(sampler, pdf);
+
+			worstPdfError = std::max(worstPdfError, fabs(environmentSampler.Pdf(dir) - pdf) / (double)pdf);
+			importanceEstimate += SampleCubeMap(planes, dir).r / pdf;
+
+			// uniform on the sphere, the pdf is 1 / 4 pi
+			Sampler uniform(i, 1, 0);
+			float z = 1 - 2 * uniform.Next();
+			float phi = 2 * (float)PI * uniform.Next();
+			float r = sqrtf(std::max(0.0f, 1 - z * z));
+
+			uniformEstimate += SampleCubeMap(planes, Vec3(r * cosf(phi), z, r * sinf(phi))).r * 4 * PI;
+		}
+
+		importanceEstimate /= numSamples;
+		uniformEstimate /= numSamples;
+
+		double estimateError = fabs(importanceEstimate - uniformEstimate) / uniformEstimate;
+
+		std::cout << "  worst pdf mismatch: " << worstPdfError << std::endl;
+		std::cout << "  light from importance sampling: " << importanceEstimate << ", uniform sampling: " << uniformEstimate << std::endl;
+
+		bool passed = true;
+
+		if ( worstPdfError > PDF_TOLERANCE ) {
+			std::cout << "  FAILED: Sample and Pdf disagree" << std::endl;
+			passed = false;
+		}
+
+		if ( estimateError > ESTIMATE_TOLERANCE ) {
+			std::cout << "  FAILED: the estimates are " << estimateError * 100 << "% apart" << std::endl;
+			passed = false;
+		}
+
+		return passed;
+
+	}
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include "Surface.h"
+#include "Renderer.h"
+#include <string>
+#include <vector>
+
+// Image checks for performance work. A regression case renders the same
+// scene with several thread counts, requires the results to be identical,
+// and compares them against a stored reference image.
+
+namespace Regression {
+
+	struct ImageDifference {
+
+		// largest difference of any color channel, from 0 to 255
+		int maxError;
+
+		// infinite when the images are identical
+		double psnr;
+
+	};
+
+	// sets up the scene on the renderer and renders it into the target
+	typedef void (*RenderCase)(Renderer& renderer, Surface& target);
+
+	unsigned long long HashSurface(const Surface& surface);
+
+	// only compares the color channels, alpha is ignored
+	ImageDifference Compare(const Surface& surface, const Surface& reference);
+
+	// the reference is read from referenceDir/name.bmp, if it does not
+	// exist the first render is saved there and the case passes. The
+	// directory is created if needed, and the case fails if it can't be saved
+	bool RunCase(const std::string& name, RenderCase renderCase, int width, int height,
+		const std::vector<int>& threadCounts, const std::string& referenceDir, int maxErrorTolerance, double minPSNR);
+
+	// checks the spherical harmonic sky light against skies with known
+	// answers: a uniform white sky gives 1 in every direction, and a white
+	// upper hemisphere gives 1 facing up, 0 facing down and 0.5 sideways
+	bool CheckSkyLight();
+
+	// samples a sky with a small bright cap using the environment sampler,
+	// and checks that the pdf Sample returns is what Pdf gives for the same
+	// direction, and that the light it estimates matches uniform sampling
+	bool CheckEnvironmentSampler(int numSamples);
+
+}
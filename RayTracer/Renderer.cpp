@@ -2,23 +2,73 @@
 #include "Vec2.h"
 #include "Mat4.h"
 #include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
 
 #define MAX_DIST 1000000000
 #define MISS_COLOR Vec4(0, 0, 0, 1);
 
-#define GET_VERTEX(INDEX, VP_VERTS, VSIZE) ((char*)VP_VERTS + (VSIZE * INDEX))
-#define GET_POSITION(INDEX, VP_VERTS, VSIZE, VFOFFSET) ((Vec3*)((float*)GET_VERTEX(INDEX, VP_VERTS, VSIZE) + VFOFFSET))
+#define GET_VERTEX(INDEX, VP_VERTS, VSIZE) ((const char*)VP_VERTS + (VSIZE * INDEX))
+#define GET_POSITION(INDEX, VP_VERTS, VSIZE, VFOFFSET) ((const Vec3*)((const float*)GET_VERTEX(INDEX, VP_VERTS, VSIZE) + VFOFFSET))
 
 #define MIN_INTERSECTION_DISTANCE 0.00001
 
+#ifdef RENDER_STATS
+
+// each thread counts into its own copy, so there is
+// no sharing between threads until the stats are merged
+static thread_local RenderStats threadStats;
+#define STAT_INC(COUNTER) (threadStats.COUNTER++)
+
+#else
+#define STAT_INC(COUNTER)
+#endif
+
+RenderStats& RenderStats::operator+=(const RenderStats& stats)
+{
+	nodesVisited += stats.nodesVisited;
+	boxesTested += stats.boxesTested;
+	trianglesTested += stats.trianglesTested;
+	hits += stats.hits;
+
+	boundingVolumeTests += stats.boundingVolumeTests;
+	closestHitShaders += stats.closestHitShaders;
+	missShaders += stats.missShaders;
+
+	for ( int i = 0; i < MAX_DEPTH; ++i )
+		raysByDepth[i] += stats.raysByDepth[i];
+
+	return *this;
+}
+
+std::ostream& operator<<(std::ostream& os, const RenderStats& stats)
+{
+	os << "Nodes visited: " << stats.nodesVisited << std::endl;
+	os << "Boxes tested: " << stats.boxesTested << std::endl;
+	os << "Triangles tested: " << stats.trianglesTested << std::endl;
+	os << "Hits: " << stats.hits << std::endl;
+	os << "Bounding volume tests: " << stats.boundingVolumeTests << std::endl;
+	os << "Closest hit shaders: " << stats.closestHitShaders << std::endl;
+	os << "Miss shaders: " << stats.missShaders << std::endl;
+
+	for ( int i = 0; i < RenderStats::MAX_DEPTH; ++i )
+		os << "Rays at depth " << i << ": " << stats.raysByDepth[i] << std::endl;
+
+	return os;
+}
+
 int Renderer::RayTracer::RecursionLevel() const
 {
 	return traceCount;
 }
 
-void Renderer::AddModelToScene(void* modelThis, int nTriangles, int* pIndices, int nVertices, void* pVertices, int positionFloatOffset, int vertexSize,
+void Renderer::AddModelToScene(void* modelThis, int nTriangles, const int* pIndices, int nVertices, const void* pVertices, int positionFloatOffset, int vertexSize,
 	 ClosestHitShader pClosestHit, BoundingVolumeTest pBoundingVolumeTest, bool backfaceCull)
 {
+	Timeline::Scope event(timeline, 0, "AddModelToScene");
+
 	ModelDescriptor md = {};
 	md.thisPtr = modelThis;
 	md.nTriangles = nTriangles;
@@ -34,22 +84,60 @@ void Renderer::AddModelToScene(void* modelThis, int nTriangles, int* pIndices, i
 	modelStorage[numModels++] = md;
 
 	ModelDescriptor* model = &modelStorage[numModels - 1];
+
+	Timeline::Scope buildEvent(timeline, 0, "BuildTree");
 	octTree.AddModelToTree(model);
 }
 
-void Renderer::RenderScene(Surface* pRenderTarget, RayGenerationShader pRayGen, MissShader pMissShader)
+RenderStats Renderer::RenderScene(Surface* pRenderTarget, RayGenerationShader pRayGen, MissShader pMissShader)
 {
+	if ( pRenderTarget == nullptr )
+		return {};
+
+	return RenderRegion(pRenderTarget, pRenderTarget->GetWidth(), pRenderTarget->GetHeight(), 0, 0, pRayGen, pMissShader);
+}
+
+RenderStats Renderer::RenderRegion(Surface* pRenderTarget, int displayWidth, int displayHeight, int regionX, int regionY,
+	RayGenerationShader pRayGen, MissShader pMissShader)
+{
+	static_assert(RenderStats::MAX_DEPTH == RayTracer::MAX_TRACE + 1, "RenderStats needs a counter for every recursion level");
+
+	RenderStats stats = {};
 
 	if ( pRenderTarget == nullptr || pRayGen == nullptr || pMissShader == nullptr )
-		return;
+		return stats;
 	if ( pRenderTarget->GetWidth() == 0 || pRenderTarget->GetHeight() == 0 )
-		return;
+		return stats;
+
+	Timeline::Scope event(timeline, 0, "RenderScene");
+
+	// a larger target would mark past the end of the progress, and
+	// tiles finished in an earlier frame are never queued again
+	if ( pProgress != nullptr ) {
+
+		if ( pProgress->GetWidth() != pRenderTarget->GetWidth() || pProgress->GetHeight() != pRenderTarget->GetHeight() ) {
+			std::cout << "The tile progress is " << pProgress->GetWidth() << "x" << pProgress->GetHeight() << " but the render target is "
+				<< pRenderTarget->GetWidth() << "x" << pRenderTarget->GetHeight() << ", not marking it." << std::endl;
+			pProgress = nullptr;
+		}
+		else if ( !pProgress->IsUnmarked() ) {
+			std::cout << "The tile progress has to be Reset before rendering another frame, not marking it." << std::endl;
+			assert(false);
+			pProgress = nullptr;
+		}
+	}
 
 	this->pRayGen = pRayGen;
 	this->pMissShader = pMissShader;
 	this->pRenderTarget = pRenderTarget;
 
-	static int numThreads = (std::thread::hardware_concurrency() - 1);
+	this->displayWidth = displayWidth;
+	this->displayHeight = displayHeight;
+	this->regionX = regionX;
+	this->regionY = regionY;
+
+	// number of threads besides this one
+	int numThreads = threadCount > 0 ? threadCount - 1 : (std::thread::hardware_concurrency() - 1);
 
 #ifdef NO_THREAD
 	numThreads = 1;
@@ -62,51 +150,105 @@ void Renderer::RenderScene(Surface* pRenderTarget, RayGenerationShader pRayGen,
 
 	std::vector<std::thread> threads;
 
+	// a lane for every render thread, SetThreadCount can ask for
+	// more threads than the timeline was enabled with
+	if ( timeline.IsEnabled() )
+		timeline.Enable(true, numThreads + 1);
+
 	// create all the worker ranges before
 	// starting the threads
 	if ( numPixels > numThreads )
 		for ( int start = 0; start < newThreadEnd; start += span )
 			workers.push_back({ start, start + span });
-	workers.push_back({ newThreadEnd, numPixels - newThreadEnd });
+	workers.push_back({ newThreadEnd, numPixels });
+
+	workerStats.assign(workers.size(), stats);
+
+	if ( renderMode != RENDER_COLOR )
+		pixelCosts.assign(numPixels, 0.0f);
 
 	// don't start new threads if each thread would get
 	// less than 1 pixel
 	int numWorkers = 0;
 	if ( numPixels > numThreads )
-		for ( int start = 0; start < newThreadEnd; start += span )
-			threads.emplace_back(&Renderer::RenderThread, this, numWorkers++);
+		for ( int start = 0; start < newThreadEnd; start += span, ++numWorkers )
+			threads.emplace_back(&Renderer::RenderThread, this, numWorkers, numWorkers + 1);
+
+	// the calling thread renders the last range, its time goes in lane 0
+	RenderThread(numWorkers, 0);
 
-	RenderThread(numWorkers);
+	// anything recorded here is time spent waiting on the slowest thread
+	long long joinStart = timeline.Now();
 
 	for ( std::thread& thread : threads )
 		thread.join();
 
+	timeline.Record(0, "WaitForThreads", joinStart, timeline.Now());
+
+	// merge the counters of every thread
+	for ( const RenderStats& workerStat : workerStats )
+		stats += workerStat;
+
+	if ( renderMode != RENDER_COLOR ) {
+		Timeline::Scope heatmapEvent(timeline, 0, "WriteHeatmap");
+		WriteHeatmap();
+
+		if ( pProgress != nullptr )
+			pProgress->MarkRect(0, 0, pRenderTarget->GetWidth(), pRenderTarget->GetHeight());
+	}
+
 	this->pRayGen = nullptr;
 	this->pMissShader = nullptr;
 	this->pRenderTarget = nullptr;
 
 	workers.clear();
+	workerStats.clear();
+	pixelCosts.clear();
+
+	return stats;
 
 }
 
-void Renderer::RenderThread(int threadIdx)
+void Renderer::RenderThread(int threadIdx, int lane)
 {
 	int width = pRenderTarget->GetWidth();
-	int height = pRenderTarget->GetHeight();
 
 	WorkerRange* volatile range = &workers[threadIdx];
 
+	const char* eventName = "RenderRange";
+
+	// the tile the last pixel went into, it is marked once
+	// this thread moves on so it is never shown half written
+	int openTile = -1;
+	unsigned int openRows[TileProgress::TILE_SIZE] = {};
+
+#ifdef RENDER_STATS
+	threadStats = {};
+#endif
+
 #ifdef THREAD_SWITCHING
 	while ( range->start < range->end ) {
 #endif
 
+		long long rangeStart = timeline.Now();
+
 		for ( ; range->start < range->end; range->start++ ) {
 
 			int p = range->start;
 
 			// get the pixel coordinates on the screen
-			int px = p % width;
-			int py = p / width;
+			int px = regionX + p % width;
+			int py = regionY + p / width;
+
+			// remember where the counters started so the heatmap
+			// modes can record what this pixel cost
+#ifdef RENDER_STATS
+			long long nodesBefore = threadStats.nodesVisited;
+			long long trianglesBefore = threadStats.trianglesTested;
+#endif
+			std::chrono::steady_clock::time_point timeBefore;
+			if ( renderMode == RENDER_TIME )
+				timeBefore = std::chrono::steady_clock::now();
 
 			Vec2 center((float)px + 0.5f * RESOLUTION, (float)py + 0.5f * RESOLUTION);
 
@@ -118,8 +260,16 @@ void Renderer::RenderThread(int threadIdx)
 			for ( int i = 0; i < RESOLUTION; ++i ) {
 				for ( int j = 0; j < RESOLUTION; ++j ) {
 
-					Ray ray = pRayGen(center.x, center.y, width, height);
-					RayTracer rayTracer(this);
+					Sampler sampler(px, py, i * RESOLUTION + j);
+
+#ifdef JITTER_SAMPLES
+					Vec2 jitter = (sampler.Next2D() - Vec2(0.5f, 0.5f)) * centerInc;
+					Ray ray = pRayGen(center.x + jitter.x, center.y + jitter.y, displayWidth, displayHeight);
+#else
+					Ray ray = pRayGen(center.x, center.y, displayWidth, displayHeight);
+#endif
+
+					RayTracer rayTracer(this, sampler);
 					Payload result = TraceRay(ray, rayTracer);
 
 					accumAvg += result.color;
@@ -132,7 +282,48 @@ void Renderer::RenderThread(int threadIdx)
 
 			accumAvg /= (RESOLUTION * RESOLUTION);
 
-			pRenderTarget->PutPixel(px, py, accumAvg);
+			switch ( renderMode ) {
+
+			case RENDER_COLOR:
+				pRenderTarget->PutPixel(px - regionX, py - regionY, accumAvg);
+
+				if ( pProgress != nullptr ) {
+
+					int tile = pProgress->TileAt(px - regionX, py - regionY);
+
+					if ( tile != openTile && openTile != -1 ) {
+						pProgress->MarkPixels(openTile, openRows);
+						memset(openRows, 0, sizeof(openRows));
+					}
+
+					openTile = tile;
+					openRows[(py - regionY) % TileProgress::TILE_SIZE] |= 1u << ((px - regionX) % TileProgress::TILE_SIZE);
+				}
+				break;
+
+#ifdef RENDER_STATS
+			case RENDER_NODE_VISITS:
+				pixelCosts[p] = (float)(threadStats.nodesVisited - nodesBefore);
+				break;
+
+			case RENDER_TRIANGLE_TESTS:
+				pixelCosts[p] = (float)(threadStats.trianglesTested - trianglesBefore);
+				break;
+#endif
+
+			case RENDER_TIME:
+				pixelCosts[p] = (float)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - timeBefore).count();
+				break;
+			}
+		}
+
+		timeline.Record(lane, eventName, rangeStart, timeline.Now());
+
+		// the next range may be anywhere else in the image
+		if ( openTile != -1 ) {
+			pProgress->MarkPixels(openTile, openRows);
+			memset(openRows, 0, sizeof(openRows));
+			openTile = -1;
 		}
 
 #ifdef THREAD_SWITCHING
@@ -146,27 +337,94 @@ void Renderer::RenderThread(int threadIdx)
 				range->end = workers[i].end;
 
 				workers[i].end = range->start;
+				eventName = "StolenRange";
 				break;
 
 			}
 		}
 	}
 #endif
+
+#ifdef RENDER_STATS
+	workerStats[threadIdx] = threadStats;
+#endif
+}
+
+Timeline& Renderer::GetTimeline()
+{
+	return timeline;
+}
+
+void Renderer::SetProgress(TileProgress* progress)
+{
+	pProgress = progress;
+}
+
+void Renderer::SetThreadCount(int count)
+{
+	threadCount = count;
 }
 
-Renderer::RayTracer::RayTracer(Renderer* renderer)
+void Renderer::SetRenderMode(int mode)
+{
+#ifndef RENDER_STATS
+	if ( mode == RENDER_NODE_VISITS || mode == RENDER_TRIANGLE_TESTS ) {
+		std::cout << "Counter heatmaps need RENDER_STATS, timing each pixel instead." << std::endl;
+		mode = RENDER_TIME;
+	}
+#endif
+
+	renderMode = mode;
+}
+
+static Vec3 HeatmapColor(float t)
+{
+	// blue -> cyan -> green -> yellow -> red as the cost goes from 0 to 1
+	static const Vec3 ramp[] = { {0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0} };
+	static constexpr int LAST = sizeof(ramp) / sizeof(Vec3) - 1;
+
+	float scaled = t * LAST;
+	int segment = std::min((int)scaled, LAST - 1);
+
+	return Vec3::Lerp(ramp[segment], ramp[segment + 1], scaled - segment);
+}
+
+void Renderer::WriteHeatmap()
+{
+	int width = pRenderTarget->GetWidth();
+	int height = pRenderTarget->GetHeight();
+
+	// normalize against the most expensive pixel in the frame
+	float maxCost = *std::max_element(pixelCosts.begin(), pixelCosts.end());
+	std::cout << "Heatmap maximum pixel cost: " << maxCost << std::endl;
+
+	if ( maxCost <= 0 )
+		maxCost = 1;
+
+	for ( int py = 0; py < height; ++py )
+		for ( int px = 0; px < width; ++px )
+			pRenderTarget->PutPixel(px, py, HeatmapColor(pixelCosts[py * width + px] / maxCost));
+}
+
+Renderer::RayTracer::RayTracer(Renderer* renderer, const Sampler& sampler)
 	:
-	renderer(renderer)
+	renderer(renderer), sampler(sampler)
 {
 	traceCount = 0;
 }
 
+Sampler& Renderer::RayTracer::GetSampler()
+{
+	return sampler;
+}
+
 Payload Renderer::RayTracer::TraceRay(const Ray& ray)
 {
 	if ( traceCount == MAX_TRACE ) {
 
 		// if we are too deep in a recursion, fall
 		// back on the miss shader
+		STAT_INC(missShaders);
 		return renderer->pMissShader(ray);
 	}
 
@@ -180,6 +438,7 @@ Payload Renderer::RayTracer::TraceRay(const Ray& ray)
 
 Payload Renderer::TraceRay(const Ray& ray, RayTracer& rayTracer)
 {
+	STAT_INC(raysByDepth[rayTracer.traceCount]);
 
 #ifdef BOUNDING_BOX_TEST
 	bool foundHit = false;
@@ -187,13 +446,16 @@ Payload Renderer::TraceRay(const Ray& ray, RayTracer& rayTracer)
 
 		ModelDescriptor& model = modelStorage[i];
 
+		STAT_INC(boundingVolumeTests);
 		if ( model.pBoundingVolumeTest(model.thisPtr, ray) ) {
 			foundHit = true;
 			break;
 		}
 	}
-	if ( !foundHit )
+	if ( !foundHit ) {
+		STAT_INC(missShaders);
 		return pMissShader(ray);
+	}
 #endif
 
 	// run the closest hit shader of the nearest object
@@ -204,9 +466,12 @@ Payload Renderer::TraceRay(const Ray& ray, RayTracer& rayTracer)
 
 	Payload payload;
 	if ( octTree.IntersectRayWithTree(ray, closestHit, closestIntersection) ) {
+		STAT_INC(hits);
+		STAT_INC(closestHitShaders);
 		payload = closestHit->pClosestHitShader(closestHit->thisPtr, rayTracer, ray, closestIntersection);
 	}
 	else {
+		STAT_INC(missShaders);
 		payload = pMissShader(ray);
 	}
 
@@ -326,8 +591,11 @@ bool Renderer::SceneOctTree::SceneOctTreeNode::IntersectRay(const Ray& ray, Mode
 {
 
 	// check if the ray intersects this box
+	STAT_INC(boxesTested);
 	if ( TestIntersectAxisAlignedBox(ray, box) ) {
 
+		STAT_INC(nodesVisited);
+
 		float minDist = MAX_DIST;
 		ModelDescriptor* closestModel = nullptr;
 		TriangleIntersection closestIntersection;
@@ -342,6 +610,7 @@ bool Renderer::SceneOctTree::SceneOctTreeNode::IntersectRay(const Ray& ray, Mode
 
 			// loop through all triangles in that model
 			for ( TriangleDesc& triangle : triangles ) {
+				STAT_INC(trianglesTested);
 				if ( IntersectTriangle(ray, *std::get<1>(triangle), *std::get<2>(triangle), *std::get<3>(triangle), currentIntersection) 
 					&& currentIntersection.distance < minDist) 
 				{
@@ -455,6 +724,8 @@ bool Renderer::IntersectTriangle(const Ray& ray, const Vec3& v1, const Vec3& v2,
 
 void Renderer::ClearScene()
 {
+	Timeline::Scope event(timeline, 0, "ClearScene");
+
 	octTree.ClearTree();
 	numModels = 0;
 }
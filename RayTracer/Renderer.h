@@ -2,6 +2,9 @@
 #include "Surface.h"
 #include "Vec3.h"
 #include "Shapes.h"
+#include "Timeline.h"
+#include "Sampling.h"
+#include "TileProgress.h"
 #include <vector>
 #include <unordered_map>
 
@@ -9,6 +12,15 @@
 #define BOUNDING_BOX_TEST
 #define THREAD_SWITCHING
 
+// offset each sample randomly inside its sub pixel cell instead of
+// using the cell center, the offsets are deterministic per pixel
+//#define JITTER_SAMPLES
+
+// traversal statistics are compiled out of release builds
+#ifndef NDEBUG
+#define RENDER_STATS
+#endif
+
 #define MAX_MODELS 100
 
 class Payload;
@@ -23,6 +35,28 @@ struct TriangleIntersection {
 	float distance;
 };
 
+struct RenderStats {
+
+	// one entry for primary rays plus one for each
+	// level of recursion the ray tracer allows
+	static constexpr int MAX_DEPTH = 6;
+
+	long long nodesVisited;
+	long long boxesTested;
+	long long trianglesTested;
+	long long hits;
+
+	long long boundingVolumeTests;
+	long long closestHitShaders;
+	long long missShaders;
+
+	long long raysByDepth[MAX_DEPTH];
+
+	RenderStats& operator+=(const RenderStats& stats);
+};
+
+std::ostream& operator<<(std::ostream& os, const RenderStats& stats);
+
 class Renderer
 {
 	friend class RayTracer;
@@ -31,17 +65,24 @@ public:
 	class RayTracer {
 		friend class Renderer;
 
+	public:
+		static const int MAX_TRACE = 5;
+
 	private:
 		int traceCount;
-		static const int MAX_TRACE = 5;
 
 		Renderer* renderer;
+		Sampler sampler;
 
 	public:
-		RayTracer(Renderer* renderer);
+		RayTracer(Renderer* renderer, const Sampler& sampler);
 		Payload TraceRay(const Ray& ray);
 
 		int RecursionLevel() const;
+
+		// random numbers for shaders that are the same
+		// every time this sample of this pixel is rendered
+		Sampler& GetSampler();
 	};
 
 	typedef Ray (*RayGenerationShader)(float px, float py, int displayWidth, int displayHeight);
@@ -50,11 +91,26 @@ public:
 
 	typedef bool (*BoundingVolumeTest)(void* thisPtr, const Ray& ray);
 
+	// debug modes write the cost of each pixel as a false color
+	// heatmap instead of the shaded color
+	enum {
+		RENDER_COLOR,
+		RENDER_NODE_VISITS,
+		RENDER_TRIANGLE_TESTS,
+		RENDER_TIME
+	};
+
 private:
 	MissShader pMissShader;
 	RayGenerationShader pRayGen;
 	Surface* pRenderTarget;
 
+	// the render target covers this part of the display
+	int displayWidth;
+	int displayHeight;
+	int regionX;
+	int regionY;
+
 	class ModelDescriptor {	
 		// use this to get the default copy constructor
 		friend class Renderer;
@@ -64,8 +120,8 @@ private:
 		int nTriangles;
 		int nVertices;
 
-		int* pIndices;
-		void* pVertices;
+		const int* pIndices;
+		const void* pVertices;
 		int vertexSize;
 		int positionFloatOffset;
 
@@ -121,20 +177,60 @@ private:
 	};
 
 	std::vector<WorkerRange> workers;
+	std::vector<RenderStats> workerStats;
+
+	// 0 uses one thread per hardware thread
+	int threadCount = 0;
+
+	int renderMode = RENDER_COLOR;
+	std::vector<float> pixelCosts;
+
+	TileProgress* pProgress = nullptr;
 
-	void RenderThread(int threadIdx);
+	void WriteHeatmap();
+
+	// lane 0 is the thread calling into the renderer,
+	// render thread i records into lane i + 1
+	Timeline timeline;
+
+	void RenderThread(int threadIdx, int lane);
 	Payload TraceRay(const Ray& ray, RayTracer& rayTracer);
 
 	static bool IntersectTriangle(const Ray& ray, const Vec3& v1, const Vec3& v2, const Vec3& v3, TriangleIntersection& outIntersection);
 
 public:
 
-	void AddModelToScene(void* modelThis, int nTriangles, int* pIndices, int nVertices, void* pVertices, int positionFloatOffset, int vertexSize,
+	void AddModelToScene(void* modelThis, int nTriangles, const int* pIndices, int nVertices, const void* pVertices, int positionFloatOffset, int vertexSize,
 		 ClosestHitShader pClosestHit, BoundingVolumeTest pBoundingVolumeTest, bool backfaceCull);
 
 	void ClearScene();
 
-	void RenderScene(Surface* pRenderTarget, RayGenerationShader pRayGen, MissShader pMissShader);
+	// the node visit and triangle test modes need RENDER_STATS,
+	// without it they fall back on timing each pixel
+	void SetRenderMode(int mode);
+
+	// total number of threads used by RenderScene, including
+	// the calling thread, 0 uses one per hardware thread
+	void SetThreadCount(int count);
+
+	// tiles of the render target are marked in progress as soon as their
+	// pixels are written, it has to be the size of the render target.
+	// The renderer doesn't reset it, another thread may be taking tiles,
+	// so the caller has to Reset it before each frame after the first.
+	// A progress that doesn't fit the frame isn't marked. nullptr stops marking
+	void SetProgress(TileProgress* progress);
+
+	// disabled until Enable is called on it
+	Timeline& GetTimeline();
+
+	// returns the traversal statistics of all threads merged together,
+	// these are all zero unless RENDER_STATS is defined
+	RenderStats RenderScene(Surface* pRenderTarget, RayGenerationShader pRayGen, MissShader pMissShader);
+
+	// renders part of a displayWidth by displayHeight image, the render target
+	// receives the pixels starting at regionX, regionY and has the size of the region
+	RenderStats RenderRegion(Surface* pRenderTarget, int displayWidth, int displayHeight, int regionX, int regionY,
+		RayGenerationShader pRayGen, MissShader pMissShader);
 
 };
 
@@ -1,6 +1,8 @@
 #include "Sampling.h"
+#include <math.h>
 
 #define WRAP_OFFSET 1e-7f
+#define MIN_FOOTPRINT_COSINE 0.05f
 
 static enum Planes {
 	POSX, NEGX,
@@ -41,21 +43,25 @@ inline static Vec4 BiLinearSample(const Surface& texture, const Vec2& texel)
 	float t = texel.t - (int)(texel.t - WRAP_OFFSET);
 
 	// texel location minus half a pixel in x and y
-	int i = (texture.GetWidth() * s - 0.5);
-	int j = (texture.GetHeight() * t - 0.5);
+	float x = texture.GetWidth() * s - 0.5f;
+	float y = texture.GetHeight() * t - 0.5f;
+
+	int i = x < 0 ? 0 : (int)x;
+	int j = y < 0 ? 0 : (int)y;
 
 	// fractional parts of the displaced texel location
-	float alpha = i - (int)i;
-	float beta = j - (int)j;
+	float alpha = x < 0 ? 0 : x - i;
+	float beta = y < 0 ? 0 : y - j;
 
-	i = (int)i;
-	j = (int)j;
+	// the pixel past the edge is the edge pixel
+	int i2 = i + 1 < texture.GetWidth() ? i + 1 : i;
+	int j2 = j + 1 < texture.GetHeight() ? j + 1 : j;
 
 	// texture samples of the 4 pixel square
-	const Vec4& c1 = texture.GetPixel(i, j);
-	const Vec4& c2 = i + 1 >= texture.GetWidth() ? texture.GetPixel(i, j) : texture.GetPixel(i + 1, j);
-	const Vec4& c3 = j + 1 >= texture.GetHeight() ? texture.GetPixel(i, j) : texture.GetPixel(i, j + 1);
-	const Vec4& c4 = i + 1 >= texture.GetWidth() || j + 1 >= texture.GetHeight() ? texture.GetPixel(i, j) : texture.GetPixel(i + 1, j + 1);
+	Vec4 c1 = texture.GetPixel(i, j);
+	Vec4 c2 = texture.GetPixel(i2, j);
+	Vec4 c3 = texture.GetPixel(i, j2);
+	Vec4 c4 = texture.GetPixel(i2, j2);
 
 	// weighted average of the 4
 	return c1 * (1 - alpha) * (1 - beta) +
@@ -64,6 +70,28 @@ inline static Vec4 BiLinearSample(const Surface& texture, const Vec2& texel)
 		c4 * alpha * beta;
 }
 
+inline static Vec4 TrilinearSample(const Surface& texture, const Vec2& texel, float footprint)
+{
+	// how many texels of the full resolution texture the footprint covers,
+	// each mip level halves that
+	float texels = footprint * (texture.GetWidth() > texture.GetHeight() ? texture.GetWidth() : texture.GetHeight());
+
+	if ( texels <= 1 )
+		return BiLinearSample(texture, texel);
+
+	float level = log2f(texels);
+	int fineLevel = (int)level;
+
+	// GetMipMap returns the smallest level for anything past the end
+	const Surface* fine = texture.GetMipMap(fineLevel);
+	const Surface* coarse = texture.GetMipMap(fineLevel + 1);
+
+	if ( fine == coarse )
+		return BiLinearSample(*fine, texel);
+
+	return Vec4::Lerp(BiLinearSample(*fine, texel), BiLinearSample(*coarse, texel), level - fineLevel);
+}
+
 Vec3 SampleNormalMap (const Surface& texture, const Vec2& texel)
 {
 	Vec4 sample = LinearSample(texture, texel);
@@ -76,7 +104,43 @@ Vec4 SampleTexture(const Surface& texture, const Vec2& texel)
 	return LinearSample(texture, texel);
 }
 
-Vec4 SampleCubeMap(const Surface* planes, const Vec3& dir)
+Vec3 SampleNormalMap(const Surface& texture, const Vec2& texel, float footprint)
+{
+	Vec4 sample = TrilinearSample(texture, texel, footprint);
+	SymmetricNormalize(sample);
+	return sample.Vec3();
+}
+
+Vec4 SampleTexture(const Surface& texture, const Vec2& texel, float footprint)
+{
+	return TrilinearSample(texture, texel, footprint);
+}
+
+float ConeFootprint(const Ray& ray, float distance, const Vec3& normal,
+	const Vec3& p1, const Vec3& p2, const Vec3& p3,
+	const Vec2& t1, const Vec2& t2, const Vec2& t3)
+{
+	// Equations from section 3.4, "Texture Level of Detail Strategies for Real-Time Ray Tracing", Akenine-Moller et al.
+
+	float width = fabs(ray.coneWidth + ray.coneSpread * distance);
+
+	// twice the areas, the factors of 2 cancel
+	float worldArea = ((p2 - p1) % (p3 - p1)).Length();
+	float texelArea = fabs((t2.s - t1.s) * (t3.t - t1.t) - (t3.s - t1.s) * (t2.t - t1.t));
+
+	if ( worldArea == 0 )
+		return 0;
+
+	// a cone hitting at a grazing angle covers a long strip of the
+	// surface, don't let it blow up to the smallest mip level
+	float cosine = fabs(normal * ray.direction) / (normal.Length() * ray.direction.Length());
+	if ( cosine < MIN_FOOTPRINT_COSINE )
+		cosine = MIN_FOOTPRINT_COSINE;
+
+	return width * sqrtf(texelArea / worldArea) / cosine;
+}
+
+int CubeMapFace(const Vec3& dir, Vec2& faceTexel)
 {
 	// Cube map sampling equations from section 7.5, "Mathematics for 3D Game Programming and Computer Graphics", Lengyel
 
@@ -84,7 +148,7 @@ Vec4 SampleCubeMap(const Surface* planes, const Vec3& dir)
 	float t = dir.t;
 	float p = dir.p;
 
-	const Surface* surfaceToSample = &planes[0];
+	int face = POSX;
 	float finalS = 0;
 	float finalT = 0;
 
@@ -99,14 +163,14 @@ Vec4 SampleCubeMap(const Surface* planes, const Vec3& dir)
 
 		if ( s > 0 ) {
 			// positive x
-			surfaceToSample = &planes[POSX];
+			face = POSX;
 			finalS = 0.5f - p / (2 * s);
 			finalT = 0.5f - t / (2 * s);
 
 		}
 		else {
 			// negative x
-			surfaceToSample = &planes[NEGX];
+			face = NEGX;
 			finalS = 0.5f - p / (2 * s);
 			finalT = 0.5f + t / (2 * s);
 		}
@@ -116,13 +180,13 @@ Vec4 SampleCubeMap(const Surface* planes, const Vec3& dir)
 
 		if ( t > 0 ) {
 			// positive y
-			surfaceToSample = &planes[POSY];
+			face = POSY;
 			finalS = 0.5f + s / (2 * t);
 			finalT = 0.5f + p / (2 * t);
 		}
 		else {
 			// negative y
-			surfaceToSample = &planes[NEGY];
+			face = NEGY;
 			finalS = 0.5f - s / (2 * t);
 			finalT = 0.5f + p / (2 * t);
 		}
@@ -132,19 +196,56 @@ Vec4 SampleCubeMap(const Surface* planes, const Vec3& dir)
 
 		if ( p > 0 ) {
 			// positive z
-			surfaceToSample = &planes[POSZ];
+			face = POSZ;
 			finalS = 0.5f + s / (2 * p);
 			finalT = 0.5f - t / (2 * p);
 		}
 		else {
 			// negative z
-			surfaceToSample = &planes[NEGZ];
+			face = NEGZ;
 			finalS = 0.5f + s / (2 * p);
 			finalT = 0.5f + t / (2 * p);
 		}
 	}
 
+	faceTexel = { finalS, finalT };
+	return face;
+
+}
+
+Vec3 CubeMapDirection(int face, const Vec2& faceTexel)
+{
+	// the equations above solved for the direction,
+	// with the largest coordinate set to 1
+	float s = faceTexel.s;
+	float t = faceTexel.t;
+
+	switch ( face ) {
+	case POSX: return { 1, 1 - 2 * t, 1 - 2 * s };
+	case NEGX: return { -1, 1 - 2 * t, 2 * s - 1 };
+	case POSY: return { 2 * s - 1, 1, 2 * t - 1 };
+	case NEGY: return { 2 * s - 1, -1, 1 - 2 * t };
+	case POSZ: return { 2 * s - 1, 1 - 2 * t, 1 };
+	default:   return { 1 - 2 * s, 1 - 2 * t, -1 };
+	}
+}
+
+Vec4 SampleCubeMap(const Surface* const planes[6], const Vec3& dir)
+{
+	Vec2 faceTexel;
+	const Surface* face = planes[CubeMapFace(dir, faceTexel)];
+
 	// don't bother with bilinear sampling, cube maps usually are high resolution
-	return LinearSample(*surfaceToSample, { finalS, finalT });
+	return LinearSample(*face, faceTexel);
+}
+
+Vec4 SampleCubeMap(const Surface* const planes[6], const Vec3& dir, float coneSpread)
+{
+	Vec2 faceTexel;
+	const Surface* face = planes[CubeMapFace(dir, faceTexel)];
 
+	// a face covers 90 degrees and is 2 units wide at distance 1, so in the
+	// middle of the face, where texels are largest, an angle of x radians
+	// covers x / 2 of the face's texture coordinates
+	return TrilinearSample(*face, faceTexel, coneSpread / 2);
 }
@@ -3,10 +3,87 @@
 #include "Vec3.h"
 #include "Vec4.h"
 #include "Surface.h"
+#include "Shapes.h"
+
+// Deterministic random numbers for one sample of one pixel. The sequence
+// only depends on the pixel and the sample index, never on which thread
+// renders the pixel, so images are reproducible for any thread count.
+class Sampler {
+
+private:
+	unsigned int seed;
+	unsigned int dimension = 0;
+
+	static inline unsigned int Hash(unsigned int x) {
+
+		// PCG output permutation, "Hash Functions for GPU Rendering", Jarzynski and Olano
+		unsigned int state = x * 747796405u + 2891336453u;
+		unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+		return (word >> 22u) ^ word;
+
+	}
+
+public:
+
+	inline Sampler(int px, int py, int sampleIndex) {
+
+		seed = Hash(Hash(Hash((unsigned int)px) + (unsigned int)py) + (unsigned int)sampleIndex);
+
+	}
+
+	// uniform in [0, 1), each call advances to the next dimension
+	inline float Next() {
+
+		return (Hash(seed + dimension++) >> 8) * (1.0f / (1 << 24));
+
+	}
+
+	// all 32 bits of the next dimension, for picking among more
+	// items than the 24 bits of a float can tell apart evenly
+	inline unsigned int NextUInt() {
+
+		return Hash(seed + dimension++);
+
+	}
+
+	inline Vec2 Next2D() {
+
+		float s = Next();
+		return { s, Next() };
+
+	}
+
+};
 
 Vec3 SampleNormalMap (const Surface& texture, const Vec2& texel);
 
 Vec4 SampleTexture(const Surface& texture, const Vec2& texel);
 
-Vec4 SampleCubeMap(const Surface* planes, const Vec3& dir);
+// planes are in the order +x, -x, +y, -y, +z, -z
+Vec4 SampleCubeMap(const Surface* const planes[6], const Vec3& dir);
+
+// the face of a cube map dir points at, in the same order as the planes,
+// and the texture coordinates on that face. Any dir that isn't 0 works
+int CubeMapFace(const Vec3& dir, Vec2& faceTexel);
+
+// the direction through a point on a face, not normalized. Coordinates
+// outside [0, 1] continue the face's plane past its edges
+Vec3 CubeMapDirection(int face, const Vec2& faceTexel);
+
+// width in texture coordinates of the ray's cone where it hits the triangle
+// at distance, for the filtered samplers below. The corners of the triangle
+// give how many texture units one world unit covers, and the normal how
+// much the footprint is stretched by the angle the ray hits at
+float ConeFootprint(const Ray& ray, float distance, const Vec3& normal,
+	const Vec3& p1, const Vec3& p2, const Vec3& p3,
+	const Vec2& t1, const Vec2& t2, const Vec2& t3);
+
+// trilinear filtered, between the two mip levels whose texels are closest
+// to the footprint in size. A footprint of 0 is a bilinear sample of the
+// full resolution texture. The mip maps have to have been generated
+Vec3 SampleNormalMap(const Surface& texture, const Vec2& texel, float footprint);
+Vec4 SampleTexture(const Surface& texture, const Vec2& texel, float footprint);
+
+// the level is picked by the angle the ray's cone spreads over
+Vec4 SampleCubeMap(const Surface* const planes[6], const Vec3& dir, float coneSpread);
 
@@ -42,6 +42,14 @@ struct Ray {
 	Vec3 origin;
 	Vec3 direction;
 
+	// the ray is the axis of a cone covering what its sample sees, used to
+	// pick texture mip levels. Width of the cone at the origin, and how
+	// much wider it gets per unit of distance. A ray with both 0 has no
+	// footprint and samples the full resolution textures.
+	// "Texture Level of Detail Strategies for Real-Time Ray Tracing", Akenine-Moller et al.
+	float coneWidth = 0;
+	float coneSpread = 0;
+
 };
 
 struct Triangle {
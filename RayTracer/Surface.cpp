@@ -1,7 +1,38 @@
 #include "Surface.h"
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <cmath>
 #include <SDL/SDL.h>
 #include "Images.h"
+#include "ThreadPool.h"
+#include "PostProcess.h"
+
+// tiles of the vertical gaussian pass, in pixels
+#define BLUR_STRIP_WIDTH 256
+#define BLUR_BAND_HEIGHT 16
+
+// rows per task of the horizontal passes
+#define BLUR_ROW_GRAIN 8
+
+// box blurs in a FastGaussianBlur, 3 is close enough to a gaussian
+#define BOX_BLUR_PASSES 3
+
+// 16 pixels are one cache line
+#define BOX_STRIP_WIDTH 16
+
+// about how many pixels of a mip level one task makes
+#define MIP_GRAIN (1 << 14)
+
+// about how many pixels one task of a flip or rescale makes
+#define TRANSFORM_GRAIN (1 << 14)
+
+// pixels per task when converting texels
+#define TEXEL_GRAIN (1 << 15)
+
+// rotations are done in squares of this many pixels a side,
+// so the rows read and the rows written both stay in the cache
+#define ROTATE_BLOCK_SIZE 32
 
 Surface::Surface(int width, int height) 
 	: 
@@ -25,29 +56,40 @@ Surface::Surface(int width, int height)
 Surface::Surface(const Surface& surface)
 	: 
 	width(surface.width), height(surface.height), allocatedSpace(surface.allocatedSpace), pitch(surface.pitch), 
-	rMask(surface.rMask), gMask(surface.gMask), bMask(surface.bMask), aMask(surface.aMask) 
+	rMask(surface.rMask), gMask(surface.gMask), bMask(surface.bMask), aMask(surface.aMask), layout(surface.layout),
+	texelFormat(surface.texelFormat)
 {
 
-	if (pPixels != nullptr)
-		delete[] pPixels;
-
-	pPixels = new int[width * height];
+	pPixels = new int[GetBufferSize() / sizeof(int)];
 	memcpy((void*)pPixels, (void*)surface.pPixels, GetBufferSize());
 
+	UpdateTexels();
+
 	std::cout << "Allocating " << GetAllocationString() << " for Surface." << std::endl;
 
 }
 Surface::Surface(Surface&& surface) noexcept :
 	width(surface.width), height(surface.height), allocatedSpace(surface.allocatedSpace), pitch(surface.pitch),
-	rMask(surface.rMask), gMask(surface.gMask), bMask(surface.bMask), aMask(surface.aMask), pPixels(surface.pPixels)
+	rMask(surface.rMask), gMask(surface.gMask), bMask(surface.bMask), aMask(surface.aMask), pPixels(surface.pPixels),
+	storage(std::move(surface.storage)), mipMap(surface.mipMap), layout(surface.layout),
+	texelFormat(surface.texelFormat), pTexels(surface.pTexels)
 {
 
 	surface.pPixels = nullptr;
+	surface.mipMap = nullptr;
+	surface.pTexels = nullptr;
 }
 
 Surface::Surface(const std::string& filename) {
 
 	pPixels = (int*)Images::Load(filename, &width, &height, BPP);
+
+	// an image that couldn't be loaded is empty
+	if (pPixels == nullptr) {
+		width = 0;
+		height = 0;
+	}
+
 	allocatedSpace = width * height;
 
 	pitch = width * 4;
@@ -60,6 +102,72 @@ Surface::Surface(const std::string& filename) {
 
 }
 
+Surface::Surface(int width, int height, int* pPixels, std::shared_ptr<const void> storage)
+	:
+	width(width), height(height), allocatedSpace(width * height), pitch(width * 4), pPixels(pPixels), storage(std::move(storage))
+{
+
+	aMask = 0xff000000;
+	bMask = 0x00ff0000;
+	gMask = 0x0000ff00;
+	rMask = 0x000000ff;
+
+}
+
+void Surface::FreeBuffer() {
+
+	// pixels kept alive by storage aren't ours to delete
+	if (storage != nullptr)
+		storage.reset();
+	else if (pPixels != nullptr)
+		delete[] pPixels;
+
+	pPixels = nullptr;
+
+}
+
+void Surface::ReplaceBuffer(int* newBuffer) {
+
+	// the texels index the old buffer, GetPixel
+	// decodes the pixels until they are converted again
+	FreeTexels();
+
+	FreeBuffer();
+	pPixels = newBuffer;
+
+}
+
+void Surface::FreeTexels() {
+
+	// both formats are allocated as floats
+	if (pTexels != nullptr)
+		delete[] (float*)pTexels;
+
+	pTexels = nullptr;
+
+}
+
+void Surface::UpdateTexels() {
+
+	FreeTexels();
+
+	if (texelFormat == TEXELS_PACKED || pPixels == nullptr)
+		return;
+
+	int numPixels = GetBufferSize() / sizeof(int);
+
+	// 4 floats per pixel, or 4 halves packed into 2 floats
+	pTexels = new float[texelFormat == TEXELS_FLOAT ? numPixels * 4 : numPixels * 2];
+
+	// every texel only depends on its own pixel, textures
+	// are converted as they load so this is worth spreading
+	ThreadPool::Global().ParallelFor(numPixels, TEXEL_GRAIN, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i)
+			UpdateTexel(i);
+	});
+
+}
+
 Surface& Surface::operator=(const Surface& surface) {
 
 	width = surface.width;
@@ -70,13 +178,17 @@ Surface& Surface::operator=(const Surface& surface) {
 	gMask = surface.gMask;
 	bMask = surface.bMask;
 	aMask = surface.aMask;
+	layout = surface.layout;
+	texelFormat = surface.texelFormat;
 
-	if (pPixels != nullptr)
-		delete[] pPixels;
+	FreeTexels();
+	FreeBuffer();
 
-	pPixels = new int[width * height];
+	pPixels = new int[GetBufferSize() / sizeof(int)];
 	memcpy((void*)pPixels, (void*)surface.pPixels, GetBufferSize());
 
+	UpdateTexels();
+
 	return *this;
 
 }
@@ -89,9 +201,21 @@ Surface& Surface::operator=(Surface&& surface) noexcept {
 	gMask = surface.gMask;
 	bMask = surface.bMask;
 	aMask = surface.aMask;
+	layout = surface.layout;
+	texelFormat = surface.texelFormat;
+
+	FreeTexels();
+	FreeBuffer();
 	pPixels = surface.pPixels;
+	pTexels = surface.pTexels;
+	storage = std::move(surface.storage);
+
+	DeleteMipMaps();
+	mipMap = surface.mipMap;
 
 	surface.pPixels = nullptr;
+	surface.pTexels = nullptr;
+	surface.mipMap = nullptr;
 
 	return *this;
 
@@ -101,8 +225,8 @@ Surface::~Surface() {
 
 	std::cout << "Freeing " << GetAllocationString() << " for Surface" << std::endl;
 
-	if (pPixels != nullptr)
-		delete[] pPixels;
+	FreeTexels();
+	FreeBuffer();
 
 	// do not call delete mip maps
 	if (mipMap != nullptr)
@@ -143,7 +267,76 @@ int Surface::GetAMask() const {
 
 int Surface::GetBufferSize() const {
 
-	return sizeof(int) * width * height;
+	if (layout == LAYOUT_LINEAR)
+		return sizeof(int) * width * height;
+
+	int paddedWidth = (width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+	int paddedHeight = (height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE;
+
+	return sizeof(int) * paddedWidth * paddedHeight;
+
+}
+
+int Surface::GetLayout() const {
+	return layout;
+}
+
+int Surface::GetTexelFormat() const {
+	return texelFormat;
+}
+
+int Surface::GetTexelBufferSize() const {
+
+	if (texelFormat == TEXELS_FLOAT)
+		return GetBufferSize() * 4;
+	if (texelFormat == TEXELS_HALF)
+		return GetBufferSize() * 2;
+
+	return 0;
+
+}
+
+void Surface::SetTexelFormat(int format) {
+
+	if (mipMap != nullptr)
+		mipMap->SetTexelFormat(format);
+
+	if (format == texelFormat)
+		return;
+
+	texelFormat = format;
+	UpdateTexels();
+
+}
+
+void Surface::SetLayout(int layout) {
+
+	if (mipMap != nullptr)
+		mipMap->SetLayout(layout);
+
+	if (layout == this->layout || pPixels == nullptr)
+		return;
+
+	int oldLayout = this->layout;
+	this->layout = layout;
+
+	// padding pixels of a tiled surface stay black
+	int* newBuf = new int[GetBufferSize() / sizeof(int)];
+	memset(newBuf, 0, GetBufferSize());
+
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+
+			int oldIndex = oldLayout == LAYOUT_LINEAR ? width * y + x : TiledIndex(x, y, width);
+			newBuf[PixelIndex(x, y)] = pPixels[oldIndex];
+
+		}
+	}
+
+	ReplaceBuffer(newBuf);
+	allocatedSpace = GetBufferSize() / sizeof(int);
+
+	UpdateTexels();
 
 }
 
@@ -154,14 +347,31 @@ void Surface::SetColorMasks(int aMask, int rMask, int gMask, int bMask) {
 	this->bMask = bMask;
 	this->aMask = aMask;
 
+	UpdateTexels();
+
 }
 
-void Surface::SaveToFile(const std::string& filename) const {
+bool Surface::SaveToFile(const std::string& filename) const {
+
+	if (layout != LAYOUT_LINEAR) {
+
+		Surface linear(*this);
+		linear.SetLayout(LAYOUT_LINEAR);
+		return linear.SaveToFile(filename);
+	}
 
 	SDL_Surface* surface = SDL_CreateRGBSurfaceFrom((void*)pPixels, width, height, BPP, pitch, rMask, gMask, bMask, aMask);
-	SDL_SaveBMP(surface, filename.c_str());
+	if (surface == nullptr)
+		return false;
+
+	bool saved = SDL_SaveBMP(surface, filename.c_str()) == 0;
 	SDL_FreeSurface(surface);
 
+	if (!saved)
+		std::cout << "Could not save " << filename << ": " << SDL_GetError() << std::endl;
+
+	return saved;
+
 }
 
 void Surface::Resize(int width, int height, bool maintainImage) {
@@ -169,6 +379,8 @@ void Surface::Resize(int width, int height, bool maintainImage) {
 	if ( width <= 0 || height <= 0 )
 		return;
 
+	SetLayout(LAYOUT_LINEAR);
+
 	if (width * height > allocatedSpace || maintainImage) {
 
 		// if there is a need to reallocate or they want to maintain the image
@@ -201,14 +413,72 @@ void Surface::Resize(int width, int height, bool maintainImage) {
 			memcpy(newBuf, pPixels, GetBufferSize());
 		}
 
-		std::swap(newBuf, pPixels);
-		delete[] newBuf;
+		ReplaceBuffer(newBuf);
 	}
 
 	this->width = width;
 	this->height = height;
 	pitch = width * 4;
 
+	UpdateTexels();
+
+}
+
+// the source pixels one axis of a resampled pixel is made of
+struct ResampleTaps {
+
+	int first;
+	int count;
+
+	// into the weights of all the taps
+	int offset;
+
+};
+
+// a tent filter around where each pixel of the new size lands in the old
+// one. When shrinking the tent is widened to cover every source pixel, so
+// the result is filtered instead of skipping pixels
+static std::vector<ResampleTaps> ComputeResampleTaps(int size, int newSize, std::vector<float>& outWeights) {
+
+	std::vector<ResampleTaps> taps(newSize);
+
+	float scale = (float)newSize / size;
+	float radius = std::max(1 / scale, 1.0f);
+
+	for (int i = 0; i < newSize; ++i) {
+
+		float center = (i + 0.5f) / scale - 0.5f;
+
+		int first = (int)std::ceil(center - radius);
+		int last = (int)std::floor(center + radius);
+
+		ResampleTaps& tap = taps[i];
+		tap.offset = (int)outWeights.size();
+
+		// clamp to the edges, pixels past them count for the edge pixel
+		tap.first = std::max(first, 0);
+		tap.count = std::min(last, size - 1) - tap.first + 1;
+		outWeights.resize(tap.offset + tap.count, 0.0f);
+
+		float sum = 0;
+
+		for (int p = first; p <= last; ++p) {
+
+			float weight = 1 - std::abs(p - center) / radius;
+			if (weight <= 0)
+				continue;
+
+			int clamped = std::min(std::max(p, 0), size - 1);
+			outWeights[tap.offset + clamped - tap.first] += weight;
+			sum += weight;
+		}
+
+		for (int w = 0; w < tap.count; ++w)
+			outWeights[tap.offset + w] /= sum;
+	}
+
+	return taps;
+
 }
 
 void Surface::Rescale(float xScale, float yScale) {
@@ -216,44 +486,83 @@ void Surface::Rescale(float xScale, float yScale) {
 	if (xScale <= 0 || yScale <= 0)
 		return;
 
-	int newWidth = width * xScale;
-	int newHeight = height * yScale;
+	SetLayout(LAYOUT_LINEAR);
+
+	int newWidth = std::max((int)(width * xScale), 1);
+	int newHeight = std::max((int)(height * yScale), 1);
+
+	std::vector<float> xWeights, yWeights;
+	std::vector<ResampleTaps> xTaps = ComputeResampleTaps(width, newWidth, xWeights);
+	std::vector<ResampleTaps> yTaps = ComputeResampleTaps(height, newHeight, yWeights);
 
 	int* newBuf = new int[newWidth * newHeight];
-	allocatedSpace = newWidth * newHeight;
 
-	for (int row = 0; row < newHeight; ++row) {
+	int rowGrain = std::max(TRANSFORM_GRAIN / newWidth, 1);
 
-		int sampleY = (float)row / newHeight * height;
+	// each new row is filtered down the columns into a row of the old
+	// width, and that row is filtered across into the new one. Nothing
+	// bigger than a row is ever in between
+	ThreadPool::Global().ParallelFor(newHeight, rowGrain, [&](int begin, int end) {
 
-		for (int col = 0; col < newWidth; ++col) {
+		std::vector<float> columns(width * 4);
+
+		// round instead of truncating, or the image would get darker
+		const __m128 half = _mm_set1_ps(0.5f / 255);
+
+		for (int row = begin; row < end; ++row) {
+
+			const ResampleTaps& yTap = yTaps[row];
+
+			for (int col = 0; col < width; ++col) {
+
+				__m128 sum = _mm_setzero_ps();
+
+				for (int j = 0; j < yTap.count; ++j) {
+					__m128 color = DecodePixel(pPixels[(yTap.first + j) * width + col]);
+					sum = _mm_add_ps(sum, _mm_mul_ps(color, _mm_set1_ps(yWeights[yTap.offset + j])));
+				}
+
+				_mm_storeu_ps(&columns[col * 4], sum);
+			}
 
-			int sampleX = (float)col / newWidth * width;
+			for (int col = 0; col < newWidth; ++col) {
 
-			newBuf[row * newWidth + col] = pPixels[sampleY * width + sampleX];
+				const ResampleTaps& xTap = xTaps[col];
+				__m128 sum = half;
 
+				for (int i = 0; i < xTap.count; ++i) {
+					__m128 color = _mm_loadu_ps(&columns[(xTap.first + i) * 4]);
+					sum = _mm_add_ps(sum, _mm_mul_ps(color, _mm_set1_ps(xWeights[xTap.offset + i])));
+				}
+
+				newBuf[row * newWidth + col] = EncodePixel(sum);
+			}
 		}
-	}
 
-	std::swap(pPixels, newBuf);
-	delete[] newBuf;
+	});
+
+	ReplaceBuffer(newBuf);
 
 	width = newWidth;
 	height = newHeight;
 	pitch = width * 4;
+	allocatedSpace = width * height;
 
+	UpdateTexels();
 
 }
 
 void Surface::WhiteOut() {
 
 	memset(pPixels, -1, GetBufferSize());
+	UpdateTexels();
 
 }
 
 void Surface::BlackOut() {
 
 	memset(pPixels, 0, GetBufferSize());
+	UpdateTexels();
 
 }
 
@@ -295,34 +604,138 @@ void Surface::DrawLine(int x1, int y1, int x2, int y2, int rgb) {
 
 }
 
+// the pixels one axis of a mip level averages, for each pixel of the level.
+// Halving an even size takes 2 pixels at half each. Halving an odd size
+// covers 2 and a bit pixels, so the outer ones count for what they cover
+struct MipTaps {
+
+	int first;
+	int count;
+	float weights[3];
+
+};
+
+static std::vector<MipTaps> ComputeMipTaps(int size, int newSize) {
+
+	std::vector<MipTaps> taps(newSize);
+	float ratio = (float)size / newSize;
+
+	for (int i = 0; i < newSize; ++i) {
+
+		float start = i * ratio;
+		float end = (i + 1) * ratio;
+
+		MipTaps& tap = taps[i];
+		tap.first = (int)start;
+		tap.count = 0;
+
+		for (int p = tap.first; p < end && p < size && tap.count < 3; ++p) {
+
+			float covered = std::min(end, (float)(p + 1)) - std::max(start, (float)p);
+			tap.weights[tap.count++] = covered / ratio;
+		}
+	}
+
+	return taps;
+
+}
+
 void Surface::GenerateMipMaps() {
 
-	if (mipMap != nullptr)
+	if (mipMap != nullptr || pPixels == nullptr)
 		return;
 
-	int mmWidth = width / 2;
-	int mmHeight = height / 2;
+	// the levels are halved until both sides are 1, an odd side rounds down
+	std::vector<int> widths, heights;
+
+	for (int w = width, h = height; w > 1 || h > 1; ) {
 
-	if (mmWidth < 1 || mmHeight < 1)
+		w = std::max(w / 2, 1);
+		h = std::max(h / 2, 1);
+
+		widths.push_back(w);
+		heights.push_back(h);
+	}
+
+	if (widths.empty())
 		return;
 
-	mipMap = new Surface(mmWidth, mmHeight);
+	// every level is in the layout of this one, and they
+	// are all in one allocation they keep alive together
+	std::vector<Surface*> levels(widths.size());
+	size_t chainSize = 0;
 
-	for (int r = 0; r < mmWidth; ++r) {
-		for (int c = 0; c < mmHeight; ++c) {
+	for (size_t l = 0; l < levels.size(); ++l) {
 
-			const Vec4& c1 = GetPixel(r * 2, c * 2);
-			const Vec4& c2 = GetPixel(r * 2 + 1, c * 2);
-			const Vec4& c3 = GetPixel(r * 2, c * 2 + 1);
-			const Vec4& c4 = GetPixel(r * 2 + 1, c * 2 + 1);
+		levels[l] = new Surface(widths[l], heights[l], nullptr, nullptr);
+		levels[l]->layout = layout;
+		levels[l]->allocatedSpace = levels[l]->GetBufferSize() / sizeof(int);
+		levels[l]->SetColorMasks(aMask, rMask, gMask, bMask);
 
-			Vec4 avg = (c1 + c2 + c3 + c4) / 4;
-			mipMap->PutPixel(r, c, avg);
+		chainSize += levels[l]->allocatedSpace;
+	}
 
-		}
+	// zeroed, so the padding of tiled levels is black
+	std::shared_ptr<int> chain(new int[chainSize](), std::default_delete<int[]>());
+	int* pLevel = chain.get();
+
+	for (Surface* level : levels) {
+		level->pPixels = pLevel;
+		level->storage = chain;
+		pLevel += level->allocatedSpace;
+	}
+
+	const Surface* source = this;
+
+	for (Surface* level : levels) {
+
+		std::vector<MipTaps> xTaps = ComputeMipTaps(source->width, level->width);
+		std::vector<MipTaps> yTaps = ComputeMipTaps(source->height, level->height);
+
+		// small levels are done in one go on this thread
+		int rowGrain = std::max(MIP_GRAIN / level->width, 1);
+
+		ThreadPool::Global().ParallelFor(level->height, rowGrain, [&](int begin, int end) {
+
+			// round instead of truncating, or every level would be darker
+			const __m128 half = _mm_set1_ps(0.5f / 255);
+
+			for (int y = begin; y < end; ++y) {
+
+				const MipTaps& yTap = yTaps[y];
+
+				for (int x = 0; x < level->width; ++x) {
+
+					const MipTaps& xTap = xTaps[x];
+					__m128 sum = half;
+
+					for (int j = 0; j < yTap.count; ++j) {
+
+						__m128 rowSum = _mm_setzero_ps();
+
+						for (int i = 0; i < xTap.count; ++i) {
+							int color = source->pPixels[source->PixelIndex(xTap.first + i, yTap.first + j)];
+							rowSum = _mm_add_ps(rowSum, _mm_mul_ps(source->DecodePixel(color), _mm_set1_ps(xTap.weights[i])));
+						}
+
+						sum = _mm_add_ps(sum, _mm_mul_ps(rowSum, _mm_set1_ps(yTap.weights[j])));
+					}
+
+					level->pPixels[level->PixelIndex(x, y)] = EncodePixel(sum);
+				}
+			}
+
+		});
+
+		source = level;
 	}
 
-	mipMap->GenerateMipMaps();
+	// linked the same way as before, each level owns the next
+	for (size_t l = 0; l + 1 < levels.size(); ++l)
+		levels[l]->mipMap = levels[l + 1];
+
+	mipMap = levels[0];
+	mipMap->SetTexelFormat(texelFormat);
 }
 
 const Surface* Surface::GetMipMap(int level) const {
@@ -335,21 +748,19 @@ const Surface* Surface::GetMipMap(int level) const {
 
 void Surface::FlipHorizontally() {
 
-	// loop halfway across the image, column by column
-	for (int c = 0; c < width / 2; ++c) {
+	SetLayout(LAYOUT_LINEAR);
 
-		// loop down the column, row by row
-		for (int r = 0; r < height; ++r) {
+	int rowGrain = std::max(TRANSFORM_GRAIN / width, 1);
 
-			// swap the pixels at r, c and r, width - c - 1
+	// every row is reversed where it is
+	ThreadPool::Global().ParallelFor(height, rowGrain, [&](int begin, int end) {
 
-			int temp = pPixels[width * r + c];
-			PutPixel(c, r, pPixels[width * r + (width - c - 1)]);
-			PutPixel(width - c - 1, r, temp);
+		for (int r = begin; r < end; ++r)
+			std::reverse(pPixels + width * r, pPixels + width * (r + 1));
 
-		}
+	});
 
-	}
+	UpdateTexels();
 
 	// apply transformation to any mip maps
 	if (mipMap != nullptr)
@@ -359,22 +770,19 @@ void Surface::FlipHorizontally() {
 
 void Surface::FlipVertically() {
 
-	// loop halway down the image, row by row
-	for (int r = 0; r < height / 2; ++r) {
+	SetLayout(LAYOUT_LINEAR);
 
-		// loop across the image, column by column
-		for (int c = 0; c < width; ++c) {
+	int rowGrain = std::max(TRANSFORM_GRAIN / width, 1);
 
-			// swap the pixels at r, c and height - r - 1, c
+	// swap each row in the top half with its row in the bottom half
+	ThreadPool::Global().ParallelFor(height / 2, rowGrain, [&](int begin, int end) {
 
-			int temp = pPixels[width * r + c];
-			PutPixel(c, r, pPixels[width * (height - r - 1) + c]);
-			PutPixel(c, height - r - 1, temp);
+		for (int r = begin; r < end; ++r)
+			std::swap_ranges(pPixels + width * r, pPixels + width * (r + 1), pPixels + width * (height - r - 1));
 
+	});
 
-		}
-
-	}
+	UpdateTexels();
 
 	// apply transformation to any mip maps
 	if (mipMap != nullptr)
@@ -382,33 +790,62 @@ void Surface::FlipVertically() {
 
 }
 
-void Surface::RotateRight() {
+// rotates a linear image a quarter turn into newBuf. Each task makes a band of
+// whole blocks of the new image, and reads a band of columns of the old one
+static void RotatePixels(const int* pixels, int width, int height, int* newBuf, bool clockwise) {
 
-	int* newBuf = new int[height * width];
-
-	int newHeight = width;
 	int newWidth = height;
+	int newHeight = width;
+
+	int numBands = (newHeight + ROTATE_BLOCK_SIZE - 1) / ROTATE_BLOCK_SIZE;
 
-	// loop through each row of the original image
-	for (int i = 0; i < height; ++i) {
+	ThreadPool::Global().ParallelFor(numBands, 1, [&](int begin, int end) {
 
-		// loop through each pixel in that row
-		for (int j = 0; j < width; ++j) {
+		for (int band = begin; band < end; ++band) {
 
-			// fill the column in the new buffer with this row,
-			// starting from the last column 
-			newBuf[newWidth * i + newHeight - j - 1] = pPixels[width * j + i];
+			int rowStart = band * ROTATE_BLOCK_SIZE;
+			int rowEnd = std::min(rowStart + ROTATE_BLOCK_SIZE, newHeight);
 
+			for (int colStart = 0; colStart < newWidth; colStart += ROTATE_BLOCK_SIZE) {
+
+				int colEnd = std::min(colStart + ROTATE_BLOCK_SIZE, newWidth);
+
+				for (int r = rowStart; r < rowEnd; ++r) {
+
+					int* dest = newBuf + newWidth * r;
+
+					// turned right, the new row r is the old column r read bottom
+					// up. Turned left it is the old column width - r - 1 top down
+					if (clockwise) {
+						for (int c = colStart; c < colEnd; ++c)
+							dest[c] = pixels[width * (height - c - 1) + r];
+					}
+					else {
+						for (int c = colStart; c < colEnd; ++c)
+							dest[c] = pixels[width * c + (width - r - 1)];
+					}
+				}
+			}
 		}
-	}
 
-	std::swap(newBuf, pPixels);
-	delete[] newBuf;
+	});
 
-	width = newWidth;
-	height = newHeight;
+}
+
+void Surface::RotateRight() {
+
+	SetLayout(LAYOUT_LINEAR);
+
+	int* newBuf = new int[height * width];
+	RotatePixels(pPixels, width, height, newBuf, true);
+
+	ReplaceBuffer(newBuf);
+
+	std::swap(width, height);
 	pitch = width * 4;
 
+	UpdateTexels();
+
 	// apply transformation to any mip maps
 	if (mipMap != nullptr)
 		mipMap->RotateRight();
@@ -417,31 +854,18 @@ void Surface::RotateRight() {
 
 void Surface::RotateLeft() {
 
-	int* newBuf = new int[height * width];
-
-	int newHeight = width;
-	int newWidth = height;
-
-	// loop through each row of the original image
-	for (int i = 0; i < height; ++i) {
+	SetLayout(LAYOUT_LINEAR);
 
-		// loop through each pixel in that row
-		for (int j = 0; j < width; ++j) {
-
-			// fill the column in the new buffer with this row,
-			// starting from the bottom of the first column 
-			newBuf[newHeight * (newHeight - i - 1) + j] = pPixels[width * j + i];
-
-		}
-	}
+	int* newBuf = new int[height * width];
+	RotatePixels(pPixels, width, height, newBuf, false);
 
-	std::swap(newBuf, pPixels);
-	delete[] newBuf;
+	ReplaceBuffer(newBuf);
 
-	width = newWidth;
-	height = newHeight;
+	std::swap(width, height);
 	pitch = width * 4;
 
+	UpdateTexels();
+
 	// apply transformation to any mip maps
 	if (mipMap != nullptr)
 		mipMap->RotateLeft();
@@ -451,17 +875,7 @@ void Surface::RotateLeft() {
 void Surface::Tint(const Vec4& target, float alpha)
 {
 
-	if (alpha < 0)
-		alpha = 0;
-	if (alpha > 1)
-		alpha = 1;
-
-	for (int* traveler = pPixels; traveler < pPixels + width * height; ++traveler) {
-
-		Vec4 tint = EXPAND4(*traveler) * (1 - alpha) + target * alpha;
-		*traveler = COMPRESS4(tint);
-
-	}
+	PostProcess().Tint(target, alpha).Apply(*this);
 
 	//apply operation to mip map as well
 	if (mipMap != nullptr)
@@ -487,7 +901,9 @@ void Surface::GaussianBlur(int kernelSize, float stdDev, int blurType) {
 	if (stdDev <= 0)
 		return;
 
-	float* weights = new float[kernelSize];
+	SetLayout(LAYOUT_LINEAR);
+
+	std::vector<float> weights(kernelSize);
 	float sumWeights = 0;
 
 	for (int w = 0; w < kernelSize; ++w) {
@@ -499,71 +915,93 @@ void Surface::GaussianBlur(int kernelSize, float stdDev, int blurType) {
 	}
 
 	// renormalize the weights so they sum to 1
-	for (float* traveler = weights; traveler < weights + kernelSize; ++traveler)
-		*traveler /= sumWeights;
+	for (float& weight : weights)
+		weight /= sumWeights;
+
+	// pixels off the image count as 0 in both directions
+	// NOTE: this makes the edges appear darker
 
 	// do vertical blur
 	if (blurType == BLUR_VERTICAL || blurType == BLUR_BOTH) {
 
 		int* blurredImage = new int[width * height];
 
-		for (int r = 0; r < height; ++r) {
-			for (int c = 0; c < width; ++c) {
+		// the vertical pass goes across rows, adding each row of the kernel to
+		// a row of sums, instead of down columns. The tiles are narrow enough
+		// that the rows of the kernel stay in the cache while a band is done
+		int stripsPerRow = (width + BLUR_STRIP_WIDTH - 1) / BLUR_STRIP_WIDTH;
+		int numBands = (height + BLUR_BAND_HEIGHT - 1) / BLUR_BAND_HEIGHT;
 
-				Vec4 weightedAverage = {};
+		ThreadPool::Global().ParallelFor(stripsPerRow * numBands, 1, [&](int begin, int end) {
 
-				for (int w = 0; w < kernelSize; ++w) {
+			std::vector<__m128> sums(BLUR_STRIP_WIDTH);
 
-					int offset = w - (kernelSize / 2);
+			for (int tile = begin; tile < end; ++tile) {
 
-					// if this offset takes us off the image, ignore this pixel
-					// NOTE: this makes the edges appear darker
-					if (r + offset < 0 || r + offset > height - 1)
-						continue;
+				int startX = tile % stripsPerRow * BLUR_STRIP_WIDTH;
+				int endX = std::min(startX + BLUR_STRIP_WIDTH, width);
+				int startY = tile / stripsPerRow * BLUR_BAND_HEIGHT;
+				int endY = std::min(startY + BLUR_BAND_HEIGHT, height);
 
-					weightedAverage += EXPAND4(pPixels[width * (r + offset) + c]) * weights[w];
+				for (int r = startY; r < endY; ++r) {
 
-				}
+					std::fill(sums.begin(), sums.end(), _mm_setzero_ps());
+
+					for (int w = 0; w < kernelSize; ++w) {
+
+						int sourceRow = r + w - (kernelSize / 2);
+						if (sourceRow < 0 || sourceRow > height - 1)
+							continue;
+
+						__m128 weight = _mm_set1_ps(weights[w]);
+						const int* source = pPixels + width * sourceRow;
+
+						for (int c = startX; c < endX; ++c)
+							sums[c - startX] = _mm_add_ps(sums[c - startX], _mm_mul_ps(DecodePixel(source[c]), weight));
 
-				blurredImage[width * r + c] = COMPRESS4(weightedAverage);
+					}
+
+					for (int c = startX; c < endX; ++c)
+						blurredImage[width * r + c] = EncodePixel(sums[c - startX]);
+				}
 			}
-		}
 
-		std::swap(pPixels, blurredImage);
-		delete[] blurredImage;
+		});
+
+		ReplaceBuffer(blurredImage);
 	}
 
 	// do horizontal blur
 	if (blurType == BLUR_HORIZONTAL || blurType == BLUR_BOTH) {
 
-		int* blurredImage = new int[width * height];
+		// rows are blurred in place, each one is copied out first
+		ThreadPool::Global().ParallelFor(height, BLUR_ROW_GRAIN, [&](int begin, int end) {
 
-		for (int r = 0; r < height; ++r) {
-			for (int c = 0; c < width; ++c) {
+			// the row with the kernel's reach of 0 on both sides
+			std::vector<__m128> row(width + kernelSize, _mm_setzero_ps());
 
-				Vec4 weightedAverage = {};
+			for (int r = begin; r < end; ++r) {
 
-				for (int w = 0; w < kernelSize; ++w) {
+				int* pixels = pPixels + width * r;
 
-					int offset = w - (kernelSize / 2);
+				for (int c = 0; c < width; ++c)
+					row[c + kernelSize / 2] = DecodePixel(pixels[c]);
 
-					// if this offset takes us off the image, ignore this pixel
-					// NOTE: this makes the edges appear darker
-					if (c + offset < 0 || c + offset > width - 1)
-						continue;
+				for (int c = 0; c < width; ++c) {
 
-					weightedAverage += EXPAND4(pPixels[width * r + c + offset]) * weights[w];
+					__m128 sum = _mm_setzero_ps();
 
-				}
+					for (int w = 0; w < kernelSize; ++w)
+						sum = _mm_add_ps(sum, _mm_mul_ps(row[c + w], _mm_set1_ps(weights[w])));
 
-				blurredImage[width * r + c] = COMPRESS4(weightedAverage);
+					pixels[c] = EncodePixel(sum);
+				}
 			}
-		}
 
-		std::swap(pPixels, blurredImage);
-		delete[] blurredImage;
+		});
 	}
-	delete[] weights;
+
+	UpdateTexels();
 
 	// do operation on mip maps with half the kernel size
 	if (mipMap != nullptr)
@@ -571,58 +1009,156 @@ void Surface::GaussianBlur(int kernelSize, float stdDev, int blurType) {
 
 }
 
-void Surface::Invert() {
+static void BoxBlurSizes(float stdDev, int radii[BOX_BLUR_PASSES]) {
 
-	for (int* traveler = pPixels; traveler < pPixels + width * height; ++traveler) {
+	// box widths whose cascade has the deviation of the gaussian,
+	// from "Fast Almost-Gaussian Filtering", Kovesi
+	float idealWidth = sqrt(12 * stdDev * stdDev / BOX_BLUR_PASSES + 1);
 
-		Vec4 old = EXPAND4(*traveler);
-		old.r = 1 - old.r;
-		old.g = 1 - old.g;
-		old.b = 1 - old.b;
-		*traveler = COMPRESS4(old);
+	int lowerWidth = (int)idealWidth;
+	if (lowerWidth % 2 == 0)
+		--lowerWidth;
 
-	}
+	int upperWidth = lowerWidth + 2;
+
+	float idealLower = (12 * stdDev * stdDev - BOX_BLUR_PASSES * lowerWidth * lowerWidth - 4 * BOX_BLUR_PASSES * lowerWidth - 3 * BOX_BLUR_PASSES) / (-4.0f * lowerWidth - 4);
+	int numLower = (int)(idealLower + 0.5f);
+
+	for (int i = 0; i < BOX_BLUR_PASSES; ++i)
+		radii[i] = ((i < numLower ? lowerWidth : upperWidth) - 1) / 2;
 
 }
 
-void Surface::SetContrast(float contrast) {
+// box blurs count lines of values down the lines, lines are next to each
+// other in memory. The sum of the box is kept running, adding the value
+// that enters and subtracting the one that leaves, so it costs the same
+// for any radius. Values off the ends count as 0
+static void BoxBlurLines(const __m128* source, __m128* dest, int length, int count, int radius, __m128* sums) {
 
-	for (int* traveler = pPixels; traveler < pPixels + width * height; ++traveler) {
+	__m128 scale = _mm_set1_ps(1.0f / (2 * radius + 1));
 
-		Vec4 old = EXPAND4(*traveler);
-		
-		old.r -= 0.5;
-		old.r *= (1 + contrast);
-		old.r += 0.5;
+	for (int i = 0; i < count; ++i)
+		sums[i] = _mm_setzero_ps();
 
-		old.g -= 0.5;
-		old.g *= (1 + contrast);
-		old.g += 0.5;
+	for (int j = 0; j <= radius && j < length; ++j)
+		for (int i = 0; i < count; ++i)
+			sums[i] = _mm_add_ps(sums[i], source[j * count + i]);
 
-		old.b -= 0.5;
-		old.b *= (1 + contrast);
-		old.b += 0.5;
+	for (int j = 0; j < length; ++j) {
 
-		old.Clamp();
+		for (int i = 0; i < count; ++i)
+			dest[j * count + i] = _mm_mul_ps(sums[i], scale);
 
-		*traveler = COMPRESS4(old);
+		if (j + radius + 1 < length)
+			for (int i = 0; i < count; ++i)
+				sums[i] = _mm_add_ps(sums[i], source[(j + radius + 1) * count + i]);
 
+		if (j - radius >= 0)
+			for (int i = 0; i < count; ++i)
+				sums[i] = _mm_sub_ps(sums[i], source[(j - radius) * count + i]);
 	}
 
 }
 
-void Surface::DeleteMipMaps() {
+void Surface::FastGaussianBlur(float stdDev, int blurType) {
+
+	if (stdDev <= 0)
+		return;
 
-	if (mipMap != nullptr) {
+	SetLayout(LAYOUT_LINEAR);
 
-		// delete the mip maps mip map, if it exists
-		if (mipMap->mipMap != nullptr)
-			mipMap->DeleteMipMaps();
+	int radii[BOX_BLUR_PASSES];
+	BoxBlurSizes(stdDev, radii);
 
-		// delete the mip map
-		delete mipMap;
+	// the passes stay in floats, pixels are only
+	// converted going in and coming out
+
+	if (blurType == BLUR_VERTICAL || blurType == BLUR_BOTH) {
+
+		// a strip of columns is one cache line of pixels wide, and the
+		// passes go down it a row at a time
+		int numStrips = (width + BOX_STRIP_WIDTH - 1) / BOX_STRIP_WIDTH;
+
+		ThreadPool::Global().ParallelFor(numStrips, 1, [&](int begin, int end) {
+
+			std::vector<__m128> strip(height * BOX_STRIP_WIDTH);
+			std::vector<__m128> blurred(height * BOX_STRIP_WIDTH);
+			std::vector<__m128> sums(BOX_STRIP_WIDTH);
+
+			for (int s = begin; s < end; ++s) {
+
+				int startX = s * BOX_STRIP_WIDTH;
+				int stripWidth = std::min(BOX_STRIP_WIDTH, width - startX);
 
+				for (int r = 0; r < height; ++r)
+					for (int c = 0; c < stripWidth; ++c)
+						strip[r * stripWidth + c] = DecodePixel(pPixels[width * r + startX + c]);
+
+				for (int pass = 0; pass < BOX_BLUR_PASSES; ++pass) {
+					BoxBlurLines(strip.data(), blurred.data(), height, stripWidth, radii[pass], sums.data());
+					strip.swap(blurred);
+				}
+
+				for (int r = 0; r < height; ++r)
+					for (int c = 0; c < stripWidth; ++c)
+						pPixels[width * r + startX + c] = EncodePixel(strip[r * stripWidth + c]);
+			}
+
+		});
 	}
+
+	if (blurType == BLUR_HORIZONTAL || blurType == BLUR_BOTH) {
+
+		ThreadPool::Global().ParallelFor(height, BLUR_ROW_GRAIN, [&](int begin, int end) {
+
+			std::vector<__m128> row(width);
+			std::vector<__m128> blurred(width);
+			__m128 sum;
+
+			for (int r = begin; r < end; ++r) {
+
+				int* pixels = pPixels + width * r;
+
+				for (int c = 0; c < width; ++c)
+					row[c] = DecodePixel(pixels[c]);
+
+				for (int pass = 0; pass < BOX_BLUR_PASSES; ++pass) {
+					BoxBlurLines(row.data(), blurred.data(), width, 1, radii[pass], &sum);
+					row.swap(blurred);
+				}
+
+				for (int c = 0; c < width; ++c)
+					pixels[c] = EncodePixel(row[c]);
+			}
+
+		});
+	}
+
+	UpdateTexels();
+
+	if (mipMap != nullptr)
+		mipMap->FastGaussianBlur(stdDev / 2, blurType);
+
+}
+
+void Surface::Invert() {
+
+	PostProcess().Invert().Apply(*this);
+
+}
+
+void Surface::SetContrast(float contrast) {
+
+	PostProcess().Contrast(contrast).Apply(*this);
+
+}
+
+void Surface::DeleteMipMaps() {
+
+	// each level deletes the levels after it
+	delete mipMap;
+	mipMap = nullptr;
+
 }
 
 std::string Surface::GetAllocationString() const {
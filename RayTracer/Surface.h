@@ -1,6 +1,8 @@
 #pragma once
 #include <string>
 #include <iostream>
+#include <memory>
+#include <immintrin.h>
 #include "Vec4.h"
 #include "Vec3.h"
 
@@ -20,8 +22,15 @@
 
 class Surface
 {
+	friend class TextureCache;
+	friend class PostProcess;
+
 private:
 	int* pPixels;
+
+	// set if the pixels belong to something else, like a mapped
+	// file, which is kept alive for as long as this surface is
+	std::shared_ptr<const void> storage;
 	int width;
 	int height;
 
@@ -36,17 +45,89 @@ private:
 
 	Surface* mipMap = nullptr;
 
+	int layout = LAYOUT_LINEAR;
+
+	// converted copy of the pixels, indexed the same way,
+	// null when the format is TEXELS_PACKED
+	int texelFormat = TEXELS_PACKED;
+	void* pTexels = nullptr;
+
 	std::string GetAllocationString() const;
 
+	void FreeBuffer();
+	void ReplaceBuffer(int* newBuffer);
+
+	// converts the pixels again after they were changed, if
+	// the surface keeps texels. Doesn't touch the mip maps
+	void UpdateTexels();
+	void FreeTexels();
+
+	// the 8 bit channels in one instruction, only the bytes inside the
+	// color masks are kept, which is what EXPAND4 does for byte masks
+	inline __m128 DecodePixel(int color) const {
+
+		__m128i channels = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(color & (rMask | gMask | bMask | aMask)));
+		return _mm_mul_ps(_mm_cvtepi32_ps(channels), _mm_set1_ps(1 / 255.0f));
+
+	}
+
+	// the reverse of DecodePixel, COMPRESS4 with
+	// the channels clamped to [0, 1] first
+	static inline int EncodePixel(__m128 color) {
+
+		__m128i channels = _mm_cvttps_epi32(_mm_mul_ps(color, _mm_set1_ps(255)));
+		channels = _mm_packus_epi32(channels, channels);
+		return _mm_cvtsi128_si32(_mm_packus_epi16(channels, channels));
+
+	}
+
+	inline void UpdateTexel(int index) {
+
+		__m128 texel = DecodePixel(pPixels[index]);
+
+		if ( texelFormat == TEXELS_FLOAT )
+			_mm_storeu_ps((float*)pTexels + index * 4, texel);
+		else
+			_mm_storel_epi64((__m128i*)((unsigned short*)pTexels + index * 4), _mm_cvtps_ph(texel, _MM_FROUND_TO_NEAREST_INT));
+
+	}
+
 public:
 
 	static constexpr int BPP = 32;
 
+	// LAYOUT_TILED stores the image as 4x4 blocks of pixels, each one a
+	// 64 byte cache line, with the blocks in rows. Nearby pixels in any
+	// direction are then usually in the same line, which suits textures
+	// sampled by incoherent rays. The width and height are padded to
+	// whole tiles. Operations that work on whole rows, like blurs, flips
+	// and rotations, put the surface back to LAYOUT_LINEAR first.
+	enum {
+		LAYOUT_LINEAR,
+		LAYOUT_TILED
+	};
+
+	static constexpr int TILE_SIZE = 4;
+
+	// TEXELS_FLOAT keeps a float copy of every pixel next to the packed
+	// ones, so GetPixel is a single load instead of unpacking the color.
+	// TEXELS_HALF keeps the copy as 16 bit floats, half the memory for a
+	// conversion per lookup. Meant for textures that are sampled far more
+	// often than they are changed, every change converts the pixels again.
+	enum {
+		TEXELS_PACKED,
+		TEXELS_FLOAT,
+		TEXELS_HALF
+	};
+
 	Surface(int width, int height);
 	Surface(const Surface& surface);
 	Surface(Surface&& surface) noexcept;
 	Surface(const std::string& filename);
 
+	// uses pixels that storage keeps alive instead of allocating them
+	Surface(int width, int height, int* pPixels, std::shared_ptr<const void> storage);
+
 	Surface& operator=(const Surface& surface);
 	Surface& operator=(Surface&& surface) noexcept;
 
@@ -61,18 +142,32 @@ public:
 	int GetBMask() const;
 	int GetAMask() const;
 	int GetBufferSize() const;
+	int GetLayout() const;
+
+	// converts the pixels and every mip map to the layout
+	void SetLayout(int layout);
+
+	// also applies to every mip map
+	void SetTexelFormat(int format);
+	int GetTexelFormat() const;
+
+	// bytes used by the converted texels, 0 for TEXELS_PACKED
+	int GetTexelBufferSize() const;
 
 	void Resize(int width, int height, bool maintainImage);
 	void Rescale(float xScale, float yScale);
 	void SetColorMasks(int aMask, int rMask, int gMask, int bMask);
 
-	void SaveToFile(const std::string& filename) const;
+	// as a bmp, returns false if the file couldn't be written
+	bool SaveToFile(const std::string& filename) const;
 
 	void WhiteOut();
 	void BlackOut();
 
 	void DrawLine(int x1, int y1, int x2, int y2, int rgb);
 
+	// halves the image until it is 1x1, an odd side is averaged with weights
+	// for how much of each pixel a texel covers. The levels share one buffer
 	void GenerateMipMaps();
 	void DeleteMipMaps();
 	const Surface* GetMipMap(int level) const;
@@ -92,39 +187,79 @@ public:
 
 	void GaussianBlur(int kernelSize, float stdDev, int blurType);
 
+	// close to GaussianBlur with the same deviation and a kernel wide
+	// enough to hold it, but a cascade of box blurs, so the time per
+	// pixel doesn't depend on the deviation. For wide blurs
+	void FastGaussianBlur(float stdDev, int blurType);
+
 	void Invert();
 	void SetContrast(float contrast);
 
-	inline const Vec4& GetPixel(int x, int y) const {
-	
-		int color = pPixels[width * y + x];
-		return EXPAND4(color);
+	static inline int TiledIndex(int x, int y, int width) {
+
+		int tilesPerRow = (width + TILE_SIZE - 1) / TILE_SIZE;
+		int tile = (y / TILE_SIZE) * tilesPerRow + x / TILE_SIZE;
+
+		return tile * TILE_SIZE * TILE_SIZE + (y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE;
+
+	}
+
+	// index of a pixel in the buffer returned by GetPixels
+	inline int PixelIndex(int x, int y) const {
+
+		if ( layout == LAYOUT_LINEAR )
+			return width * y + x;
+
+		return TiledIndex(x, y, width);
+
+	}
+
+	inline Vec4 GetPixel(int x, int y) const {
+
+		int index = PixelIndex(x, y);
+		__m128 texel;
+
+		if ( pTexels == nullptr )
+			texel = DecodePixel(pPixels[index]);
+		else if ( texelFormat == TEXELS_FLOAT )
+			texel = _mm_loadu_ps((const float*)pTexels + index * 4);
+		else
+			texel = _mm_cvtph_ps(_mm_loadl_epi64((const __m128i*)((const unsigned short*)pTexels + index * 4)));
+
+		Vec4 color;
+		_mm_storeu_ps(&color.x, texel);
+		return color;
 
 	}
 
 	inline void PutPixel(int x, int y, const Vec4& v) {
 
-		pPixels[width * y + x] = COMPRESS4(v);
+		PutPixel(x, y, COMPRESS4(v));
 
 	}
 
 	inline void PutPixel(int x, int y, const Vec3& v) {
 
-		pPixels[width * y + x] = COMPRESS3(v);
+		PutPixel(x, y, COMPRESS3(v));
 
 	}
 
 	inline void PutPixel(int x, int y, int rgb) {
 
-		pPixels[width * y + x] = rgb;
+		int index = PixelIndex(x, y);
+		pPixels[index] = rgb;
+
+		if ( pTexels != nullptr )
+			UpdateTexel(index);
 
 	}
 
 	inline void PutPixel(int x, int y, float grayscale) {
 
 		// memset to the grayscale value * 255, or'd with the Alpha mask so it does not vary in transparency
-		memset(pPixels + width * y + x, (unsigned char)(255 * grayscale), sizeof(int));
-		pPixels[width * y + x] |= aMask;
+		int color;
+		memset(&color, (unsigned char)(255 * grayscale), sizeof(int));
+		PutPixel(x, y, color | (int)aMask);
 
 	}
 
@@ -8,6 +8,13 @@
 #include "Sampling.h"
 #include "Renderer.h"
 #include "Lighting.h"
+#include "Regression.h"
+#include "Distributed.h"
+#include "AssetCache.h"
+#include "Benchmarks.h"
+#include "EnvironmentMap.h"
+#include "IrradianceSH.h"
+#include "EnvironmentSampler.h"
 
 #include <iostream>
 #include <math.h>
@@ -17,8 +24,36 @@
 #define WIDTH 1920
 #define HEIGHT 1080
 
+// size of the tiles handed to worker processes
+#define DISTRIBUTED_TILE_SIZE 64
+#define DISTRIBUTED_TILE_TIMEOUT 10
+#define DISTRIBUTED_GIVE_UP 60
+
+// render the benchmark scenes and check them against
+// the reference images instead of opening the viewer
+//#define REGRESSION_TEST
+
+// time texture lookups in the linear and tiled
+// layouts on a cube map face before rendering
+//#define SAMPLING_BENCHMARK
+
+// how blurry the reflections on the cows are, 0 is a mirror
+#define COW_ROUGHNESS 0.3f
+
+// bump the cows with images/norm.png, filtered by each ray's cone
+#define COW_NORMAL_MAP
+
 Vec3 light(0, 0, -1);
 
+// trace this many rays toward the bright parts of the sky for the
+// ambient light of primary hits, instead of using skyLight. Slower,
+// but the cows shadow each other
+//#define SKY_RAYS 16
+
+// diffuse light from the cube map, made by FinishCubeMap
+std::unique_ptr<IrradianceSH> skyLight;
+std::unique_ptr<EnvironmentSampler> skySampler;
+
 bool IntersectSphere(void* thisPtr, const Ray& ray);
 
 bool BoundingTest(void* thisPtr, const Ray& ray);
@@ -35,9 +70,17 @@ private:
 	int nVertices;
 	int nTriangles;
 
-	int* pIndices;
+	// shared by every cow, the indices are used straight from the scene
+	AssetCache::SceneHandle scene;
+	AssetCache::TextureHandle normalMap;
+
+	// decodes on the thread pool until FinishLoading
+	std::shared_future<AssetCache::TextureHandle> normalMapLoad;
+
+	const int* pIndices;
 
-	Surface normalMap;
+	// the normal map needs texture coordinates
+	bool hasTexels;
 
 	class Vertex {
 	public:
@@ -62,29 +105,57 @@ private:
 public:
 
 	CowModel(const Vec3& pos)
-		:
-		normalMap("images/norm.png")
 	{
+		// the normal map decodes on the thread pool while the mesh loads
+		// and the scene is built, FinishLoading waits for it
+		normalMapLoad = AssetCache::Global().LoadTextureAsync("images/norm.png", AssetCache::TEXTURE_DISK_CACHE);
+		scene = AssetCache::Global().LoadScene("models/OBJ/Cow2.obj");
+
+		// an empty cow that adds nothing to the scene
+		if ( scene == nullptr ) {
+			std::cout << "Couldn't load the cow" << std::endl;
+
+			nVertices = 0;
+			nTriangles = 0;
+			pVertices = nullptr;
+			pIndices = nullptr;
+			hasTexels = false;
+			return;
+		}
+
 		rot = Mat4::GetRotation(0, 0, 0);
 		move = Mat4::Get3DTranslation(pos.x, pos.y, pos.z);
 		scale = Mat4::GetScale(1, 1, 1);
 
-		Scene scene("models/OBJ/Cow2.obj");
-		Mesh cow = scene.MeshAt(0);
+		Mesh cow = scene->MeshAt(0);
 
 		nVertices = cow.NumVertices();
 		pVertices = new Vertex[nVertices];
 
 		nTriangles = cow.NumTriangles();
-		pIndices = new int[nTriangles * 3];
-
-		for ( int i = 0; i < nVertices; ++i ) {
-			pVertices[i].position = cow.Positions(i).Vec4();
-			pVertices[i].normal = cow.Normals(i);
-		}
-
-		for ( int i = 0; i < nTriangles * 3; ++i ) {
-			pIndices[i] = cow.Indices(i);
+		pIndices = cow.IndexData();
+
+		// position.w keeps its default of 1
+		cow.CopyPositions(&pVertices[0].position, sizeof(Vertex));
+		cow.CopyNormals(&pVertices[0].normal, sizeof(Vertex));
+
+		hasTexels = cow.HasTextureCoords();
+		if ( hasTexels ) {
+			cow.CopyTextureCoords(&pVertices[0].texel, sizeof(Vertex));
+
+			if ( cow.HasTangentsAndBitangents() ) {
+				cow.CopyTangents(&pVertices[0].tangent, sizeof(Vertex));
+				cow.CopyBitangents(&pVertices[0].bitangent, sizeof(Vertex));
+			}
+			else {
+				CalculateTangentsAndBitangents(nTriangles, pIndices, nVertices, pVertices,
+					FLOAT_OFFSET(pVertices[0], position),
+					FLOAT_OFFSET(pVertices[0], texel),
+					FLOAT_OFFSET(pVertices[0], normal),
+					FLOAT_OFFSET(pVertices[0], tangent),
+					FLOAT_OFFSET(pVertices[0], bitangent)
+				);
+			}
 		}
 
 		/*nVertices = 4;
@@ -129,6 +200,8 @@ public:
 		for ( int i = 0; i < nVertices; ++i ) {
 			pVertices[i].worldPos = (move * rot * scale * pVertices[i].position).Vec3();
 			pVertices[i].normal = (rot * pVertices[i].normal.Vec4()).Vec3();
+			pVertices[i].tangent = (rot * pVertices[i].tangent.Vec4()).Vec3();
+			pVertices[i].bitangent = (rot * pVertices[i].bitangent.Vec4()).Vec3();
 		}
 		for ( int i = 0; i < 8; ++i ) {
 			Vec3& corner = *((Vec3*)&bb + i);
@@ -139,12 +212,25 @@ public:
 
 	~CowModel()
 	{
-		delete[] pIndices;
 		delete[] pVertices;
 	}
 
+	bool IsLoaded() const
+	{
+		return scene != nullptr;
+	}
+
+	// has to be called before rendering
+	void FinishLoading()
+	{
+		normalMap = normalMapLoad.get();
+	}
+
 	void AddToScene(Renderer& r)
 	{
+		if ( !IsLoaded() )
+			return;
+
 		r.AddModelToScene(this, nTriangles, pIndices, nVertices, pVertices, FLOAT_OFFSET(pVertices[0], worldPos), sizeof(Vertex), ClosestHit, BoundingTest, false);
 	}
 };
@@ -170,11 +256,19 @@ Payload ClosestHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray
 	CowModel::Vertex hit = BarycentricLerp(v1, v2, v3, intersection.u, intersection.v);
 	hit.normal = hit.normal.Normalized();
 
-	/*Vec3 realNormal = SampleNormalMap(cow->normalMap, hit.texel);
-	Mat3 tanToObj(hit.tangent, hit.bitangent, hit.normal.Normalized());
-	Vec3 n = tanToObj * realNormal;
-	n = (cow->rot * n.Vec4()).Vec3();
-	hit.normal = n;*/
+#ifdef COW_NORMAL_MAP
+	if ( cow->hasTexels && cow->normalMap != nullptr ) {
+
+		// the cone picks the mip level, so distant cows don't alias
+		// without tracing more rays per pixel
+		float footprint = ConeFootprint(ray, intersection.distance, hit.normal, v1.worldPos, v2.worldPos, v3.worldPos, v1.texel, v2.texel, v3.texel);
+		Vec3 realNormal = SampleNormalMap(*cow->normalMap, hit.texel, footprint);
+
+		// the tangents were rotated with the normals
+		Mat3 tanToWorld(hit.tangent, hit.bitangent, hit.normal);
+		hit.normal = (tanToWorld * realNormal).Normalized();
+	}
+#endif
 
 	Vec3 toLight = (light - hit.worldPos).Normalized();
 	Vec3 lightCol = { 0.5, 0.5, 0.5 };
@@ -197,6 +291,13 @@ Payload ClosestHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray
 	Ray reflection;
 	reflection.origin = hit.worldPos;
 	reflection.direction = (-ray.direction).Reflect(hit.normal);
+
+	// the cone keeps growing from where it hit, a curved
+	// surface would also change how fast it spreads. A rough
+	// surface reflects a lobe about 2 roughness^2 radians wide,
+	// the miss shader turns the cone back into a roughness
+	reflection.coneWidth = ray.coneWidth + ray.coneSpread * intersection.distance;
+	reflection.coneSpread = ray.coneSpread + 2 * COW_ROUGHNESS * COW_ROUGHNESS;
 	Payload refl = rayTracer.TraceRay(reflection);
 
 	// the colors based on the materials surface properties
@@ -210,8 +311,36 @@ Payload ClosestHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray
 		nonLightCol
 	);
 
-	// ambient and emmissive color would be added to this
-	Vec3 finalColor = nonAmbientColor;
+	// the sky lights the diffuse color from every direction
+	Vec3 skyIrradiance = skyLight->Irradiance(hit.normal);
+
+#ifdef SKY_RAYS
+	if ( rayTracer.RecursionLevel() == 0 ) {
+
+		skyIrradiance = {};
+
+		for ( int i = 0; i < SKY_RAYS; ++i ) {
+
+			float pdf;
+			Ray sky;
+			sky.origin = hit.worldPos;
+			sky.direction = skySampler->Sample(rayTracer.GetSampler(), pdf);
+
+			float cosine = sky.direction * hit.normal;
+			if ( cosine <= 0 )
+				continue;
+
+			// Monte Carlo estimate of the cosine weighted light over pi
+			Payload skyHit = rayTracer.TraceRay(sky);
+			skyIrradiance += skyHit.color * (cosine / ((float)PI * pdf * SKY_RAYS));
+		}
+	}
+#endif
+
+	Vec3 ambientColor = Vec3::Modulate(Vec3(0, 0, 1), skyIrradiance);
+
+	// emmissive color would be added to this
+	Vec3 finalColor = nonAmbientColor + ambientColor;
 	//if ( shadowHit.intersected )
 		//finalColor -= {0.3, 0.3, 0.3};
 
@@ -222,6 +351,115 @@ Payload ClosestHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray
 
 }
 
+Payload FloorHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray, const TriangleIntersection& intersection);
+
+// a normal mapped floor running off toward the horizon, the second
+// regression scene. The texture repeats, so far away one pixel covers
+// many texels, and the reflections and sky light come from the cube map
+class FloorModel {
+
+	friend Payload FloorHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray, const TriangleIntersection& intersection);
+
+private:
+
+	class Vertex {
+	public:
+		Vec4 position;
+		Vec3 normal;
+		Vec2 texel;
+		Vec3 tangent;
+		Vec3 bitangent;
+	};
+
+	Vertex vertices[4];
+	// the front faces up, the renderer only
+	// hits triangles from the front
+	int indices[6] = { 0, 3, 1, 1, 3, 2 };
+
+	AssetCache::TextureHandle normalMap;
+	std::shared_future<AssetCache::TextureHandle> normalMapLoad;
+
+public:
+
+	FloorModel()
+	{
+		normalMapLoad = AssetCache::Global().LoadTextureAsync("images/norm.png", AssetCache::TEXTURE_DISK_CACHE);
+
+		// as large as the renderer's scene box allows, 2 units a repeat
+		vertices[0].position = { -19, -1, 1, 1 };
+		vertices[1].position = { -19, -1, -19, 1 };
+		vertices[2].position = { 19, -1, -19, 1 };
+		vertices[3].position = { 19, -1, 1, 1 };
+
+		vertices[0].texel = { 0, 0 };
+		vertices[1].texel = { 0, 10 };
+		vertices[2].texel = { 19, 10 };
+		vertices[3].texel = { 19, 0 };
+
+		for ( Vertex& v : vertices )
+			v.normal = { 0, 1, 0 };
+
+		CalculateTangentsAndBitangents(2, indices, 4, vertices,
+			FLOAT_OFFSET(vertices[0], position),
+			FLOAT_OFFSET(vertices[0], texel),
+			FLOAT_OFFSET(vertices[0], normal),
+			FLOAT_OFFSET(vertices[0], tangent),
+			FLOAT_OFFSET(vertices[0], bitangent)
+		);
+	}
+
+	// has to be called before rendering
+	void FinishLoading()
+	{
+		normalMap = normalMapLoad.get();
+	}
+
+	void AddToScene(Renderer& r)
+	{
+		r.AddModelToScene(this, 2, indices, 4, vertices, FLOAT_OFFSET(vertices[0], position), sizeof(Vertex), FloorHit, FloorBoundingTest, false);
+	}
+
+	static bool FloorBoundingTest(void* thisPtr, const Ray& ray)
+	{
+		return true;
+	}
+};
+
+Payload FloorHit(void* thisPtr, Renderer::RayTracer& rayTracer, const Ray& ray, const TriangleIntersection& intersection)
+{
+	Payload payload;
+	FloorModel* floor = (FloorModel*)thisPtr;
+
+	const FloorModel::Vertex& v1 = floor->vertices[floor->indices[intersection.triangleIdx * 3]];
+	const FloorModel::Vertex& v2 = floor->vertices[floor->indices[intersection.triangleIdx * 3 + 1]];
+	const FloorModel::Vertex& v3 = floor->vertices[floor->indices[intersection.triangleIdx * 3 + 2]];
+
+	FloorModel::Vertex hit = BarycentricLerp(v1, v2, v3, intersection.u, intersection.v);
+	Vec3 worldPos = hit.position.Vec3();
+
+	if ( floor->normalMap != nullptr ) {
+		float footprint = ConeFootprint(ray, intersection.distance, hit.normal, v1.position.Vec3(), v2.position.Vec3(), v3.position.Vec3(), v1.texel, v2.texel, v3.texel);
+		Mat3 tanToWorld(hit.tangent, hit.bitangent, hit.normal);
+		hit.normal = (tanToWorld * SampleNormalMap(*floor->normalMap, hit.texel, footprint)).Normalized();
+	}
+
+	Ray reflection;
+	reflection.origin = worldPos;
+	reflection.direction = (-ray.direction).Reflect(hit.normal);
+	reflection.coneWidth = ray.coneWidth + ray.coneSpread * intersection.distance;
+	reflection.coneSpread = ray.coneSpread + 2 * COW_ROUGHNESS * COW_ROUGHNESS;
+	Payload refl = rayTracer.TraceRay(reflection);
+
+	// a gray floor, lit by the sky and reflecting it
+	Vec3 albedo = { 0.5, 0.5, 0.5 };
+	Vec3 finalColor = Vec3::Modulate(albedo, skyLight->Irradiance(hit.normal)) + refl.color * 0.25f;
+
+	finalColor.Clamp();
+	payload.color = finalColor;
+	payload.intersected = true;
+	return payload;
+}
+
 float fov = 90;
 Ray PinholeCameraRayGeneration(float px, float py, int displayWidth, int displayHeight)
 {
@@ -256,66 +494,291 @@ Ray PinholeCameraRayGeneration(float px, float py, int displayWidth, int display
 	Vec3 dir = (camSpace - origin).Normalized();
 
 	Ray ray = { origin, dir };
+
+	// the cone covers one sample's cell, a pixel is 2 tan(fov / 2) / height
+	// wide on the viewing plane, which is 1 unit from the camera
+	ray.coneWidth = 0;
+	ray.coneSpread = 2 * tan((fov / 2) * (PI / 180)) / displayHeight / RESOLUTION;
 	
 	return ray;
 }
 
-Surface cubeMap[] = {
-	Surface("cube/posx.jpg"),
-	Surface("cube/negx.jpg"),
-	Surface("cube/posy.jpg"),
-	Surface("cube/negy.jpg"),
-	Surface("cube/posz.jpg"),
-	Surface("cube/negz.jpg")
+static const char* const cubeMapFiles[] = {
+	"cube/posx.jpg",
+	"cube/negx.jpg",
+	"cube/posy.jpg",
+	"cube/negy.jpg",
+	"cube/posz.jpg",
+	"cube/negz.jpg"
 };
 
+// the faces decode in parallel on the thread pool while the scene
+// loads, cubeMap and environment can be used once FinishCubeMap returns
+std::shared_future<AssetCache::TextureHandle> cubeMapLoads[6];
+AssetCache::TextureHandle cubeMapFaces[6];
+const Surface* cubeMap[6];
+std::unique_ptr<EnvironmentMap> environment;
+
+void StartCubeMap()
+{
+	for ( int i = 0; i < 6; ++i )
+		cubeMapLoads[i] = AssetCache::Global().LoadTextureAsync(cubeMapFiles[i], AssetCache::TEXTURE_DISK_CACHE | AssetCache::TEXTURE_HALF_TEXELS);
+}
+
+// returns false if a face couldn't be loaded
+bool FinishCubeMap()
+{
+	for ( int i = 0; i < 6; ++i ) {
+		cubeMapFaces[i] = cubeMapLoads[i].get();
+		cubeMap[i] = cubeMapFaces[i].get();
+
+		if ( cubeMap[i] == nullptr ) {
+			std::cout << "Couldn't load the cube map face " << cubeMapFiles[i] << std::endl;
+			return false;
+		}
+	}
+
+	// the blurry levels are filtered the first time and cached after that
+	environment.reset(new EnvironmentMap(cubeMapFaces, "cube/environment"));
+	skyLight.reset(new IrradianceSH(cubeMap));
+	skySampler.reset(new EnvironmentSampler(cubeMap));
+
+	return true;
+}
+
 
 Payload Miss(const Ray& ray)
 {
 	Payload payload;
-	payload.color = SampleCubeMap(cubeMap, ray.direction.Normalized()).Vec3();
+	payload.color = environment->SampleCone(ray.direction, ray.coneSpread).Vec3();
 
 	payload.intersected = false;
 
 	return payload;
 }
 
-Window wnd("My Window", 12, 12, WIDTH, HEIGHT, 0);
+// only made by the process showing the image, workers don't open one
+std::unique_ptr<Window> wnd;
 Surface surf(WIDTH, HEIGHT);
+TileProgress progress(WIDTH, HEIGHT);
+
+// the display wakes up this often even if nothing was rendered,
+// to notice it should quit and to repaint a finished image
+#define DRAW_TIMEOUT_MS 100
 
 volatile bool shouldQuit = false;
 
+void RenderCowScene(Renderer& renderer, Surface& target)
+{
+	CowModel cm({ 0, 0, -9 });
+	CowModel cm2({ -5, 0, -5 });
+
+	cm.AddToScene(renderer);
+	cm2.AddToScene(renderer);
+
+	cm.FinishLoading();
+	cm2.FinishLoading();
+
+	renderer.RenderScene(&target, PinholeCameraRayGeneration, Miss);
+	renderer.ClearScene();
+}
+
+void RenderFloorScene(Renderer& renderer, Surface& target)
+{
+	FloorModel floor;
+
+	floor.AddToScene(renderer);
+	floor.FinishLoading();
+
+	renderer.RenderScene(&target, PinholeCameraRayGeneration, Miss);
+	renderer.ClearScene();
+}
+
 void DrawLoop()
 {
+	std::vector<int> tiles;
+	std::vector<SDL_Rect> rects;
+
+	int finishedTiles = 0;
+	int reportedPercent = 0;
+
+	wnd->DrawSurface(surf);
+
+	// sleeps while the render threads work, and uploads
+	// only the tiles they finished since the last draw
 	while ( !shouldQuit ) {
-		wnd.DrawSurface(surf);
+
+		progress.WaitForTiles(tiles, DRAW_TIMEOUT_MS);
+
+		rects.resize(tiles.size());
+		for ( size_t i = 0; i < tiles.size(); ++i )
+			progress.GetTileRect(tiles[i], rects[i].x, rects[i].y, rects[i].w, rects[i].h);
+
+		wnd->DrawSurface(surf, rects.data(), (int)rects.size());
+
+		// report how much of the frame is done, from the tiles that are finished
+		int tile;
+		while ( progress.PopFinishedTile(tile) )
+			finishedTiles++;
+
+		int percent = finishedTiles * 100 / progress.NumTiles();
+		if ( percent / 10 > reportedPercent / 10 ) {
+			std::cout << percent << "% of tiles finished" << std::endl;
+			reportedPercent = percent;
+		}
 	}
 }
 
+// the draw loop uses the globals, it has to be stopped before main returns
+void StopDrawLoop(std::thread& t)
+{
+	shouldQuit = true;
+
+	if ( t.joinable() )
+		t.join();
+}
+
 int main(int argc, char* argv[])
 {
-	std::thread t(DrawLoop);
+	double loadStart = (double)SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+
+	StartCubeMap();
+
+#ifdef REGRESSION_TEST
+	if ( !FinishCubeMap() )
+		return 1;
+
+	int hardwareThreads = std::thread::hardware_concurrency();
+
+	bool passed = Regression::RunCase("cows", RenderCowScene, 480, 270, { 1, 2, hardwareThreads }, "references", 0, 100);
+	passed = Regression::RunCase("floor", RenderFloorScene, 480, 270, { 1, 2, hardwareThreads }, "references", 0, 100) && passed;
+	passed = Regression::CheckSkyLight() && passed;
+	passed = Regression::CheckEnvironmentSampler(1 << 18) && passed;
+
+	std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+	return passed ? 0 : 1;
+#endif
+
+	// distributed rendering, run one process with --coordinator <port>
+	// and any number of processes with --worker <port>. The coordinator
+	// takes an image file after the port to save to instead of showing
+	// the frame, and --render <image> does the same in one process,
+	// DistributedTest.bat uses them to compare the two
+	bool coordinator = argc >= 3 && std::string(argv[1]) == "--coordinator";
+	bool worker = argc >= 3 && std::string(argv[1]) == "--worker";
+
+	std::string outputFile;
+	if ( coordinator && argc >= 4 )
+		outputFile = argv[3];
+	else if ( argc >= 3 && std::string(argv[1]) == "--render" )
+		outputFile = argv[2];
+
+	bool showWindow = outputFile.empty();
+
+	if ( worker ) {
+
+		Renderer renderer;
+		CowModel cm({ 0, 0, -9 });
+		CowModel cm2({ -5, 0, -5 });
+
+		if ( !cm.IsLoaded() || !cm2.IsLoaded() )
+			return 1;
+
+		cm.AddToScene(renderer);
+		cm2.AddToScene(renderer);
+
+		if ( !FinishCubeMap() )
+			return 1;
+
+		cm.FinishLoading();
+		cm2.FinishLoading();
+
+		return Distributed::RunWorker("127.0.0.1", atoi(argv[2]), "cows", renderer, PinholeCameraRayGeneration, Miss) ? 0 : 1;
+	}
+
+	std::thread t;
+
+	if ( showWindow ) {
+		wnd.reset(new Window("My Window", 12, 12, WIDTH, HEIGHT, 0));
+		t = std::thread(DrawLoop);
+	}
 
 	Renderer renderer;
+	renderer.SetProgress(&progress);
+
+	// record the render phases for chrome://tracing
+	//renderer.GetTimeline().Enable(true);
+
 	CowModel cm({ 0, 0, -9 });
 	CowModel cm2({ -5, 0, -5 });
-	
+
+	if ( !cm.IsLoaded() || !cm2.IsLoaded() ) {
+		StopDrawLoop(t);
+		return 1;
+	}
 	
 	double start = (double)SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
 
 	cm.AddToScene(renderer);
 	cm2.AddToScene(renderer);
-	renderer.RenderScene(&surf, PinholeCameraRayGeneration, Miss);
+
+	// the draw thread uses the globals, it can't be left running
+	if ( !FinishCubeMap() ) {
+		StopDrawLoop(t);
+		return 1;
+	}
+
+	// the normal map decoded while the trees were built
+	cm.FinishLoading();
+	cm2.FinishLoading();
+
+	double loadEnd = (double)SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
+	std::cout << "Ready to render after " << (loadEnd - loadStart) << " seconds" << std::endl;
+
+#ifdef SAMPLING_BENCHMARK
+	Benchmarks::SampleLayouts(*cubeMap[0], 1 << 16);
+	Benchmarks::FilterFootprints(*cubeMap[0], 1 << 14, 8);
+	Benchmarks::FilterFootprints(*cubeMap[0], 1 << 14, 32);
+#endif
+
+	// show where the traversal cost is instead of the shaded image
+	//renderer.SetRenderMode(Renderer::RENDER_NODE_VISITS);
+
+	RenderStats stats = {};
+	bool rendered = true;
+
+	if ( coordinator )
+		rendered = Distributed::Coordinator(atoi(argv[2]), DISTRIBUTED_TILE_SIZE, DISTRIBUTED_TILE_TIMEOUT, DISTRIBUTED_GIVE_UP).Render(surf, "cows", &progress);
+	else
+		stats = renderer.RenderScene(&surf, PinholeCameraRayGeneration, Miss);
+
 	renderer.ClearScene();
 	
 	double end = (double)SDL_GetPerformanceCounter() / SDL_GetPerformanceFrequency();
 	std::cout << (end - start) << " seconds" << std::endl;
 
-	//wnd.DrawSurface(surf);
-	wnd.BlockUntilQuit();
+#ifdef RENDER_STATS
+	std::cout << stats;
+#endif
 
-	shouldQuit = true;
-	t.join();
+	// saving is the last phase of a headless frame, the
+	// window's uploads happen on the draw thread instead
+	bool saved = true;
+	if ( !showWindow && rendered ) {
+		Timeline::Scope saveEvent(renderer.GetTimeline(), 0, "SaveImage");
+		saved = surf.SaveToFile(outputFile);
+	}
+
+	if ( renderer.GetTimeline().IsEnabled() )
+		renderer.GetTimeline().ExportChromeTrace("timeline.json");
+
+	if ( !showWindow )
+		return rendered && saved ? 0 : 1;
+
+	//wnd->DrawSurface(surf);
+	wnd->BlockUntilQuit();
+
+	StopDrawLoop(t);
 	return 0;
 
 }
\ No newline at end of file
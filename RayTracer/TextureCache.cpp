@@ -0,0 +1,192 @@
+#include "TextureCache.h"
+#include "MappedFile.h"
+#include <fstream>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+
+#define TEXTURE_CACHE_VERSION 3
+
+// every level starts on a boundary of this many bytes
+#define TEXTURE_CACHE_ALIGNMENT 64
+
+const char* const TextureCache::CACHE_EXTENSION = ".rttex";
+
+struct TextureHeader {
+
+	char magic[4];
+	unsigned int version;
+
+	// the image the cache was made from, if either of
+	// these changes the cache is out of date
+	long long sourceSize;
+	long long sourceTime;
+
+	unsigned int rMask;
+	unsigned int gMask;
+	unsigned int bMask;
+	unsigned int aMask;
+
+	// one of Surface's layouts, for every level
+	unsigned int layout;
+
+	unsigned int numLevels;
+
+};
+
+struct TextureLevel {
+
+	unsigned int width;
+	unsigned int height;
+	unsigned long long offset;
+
+};
+
+std::shared_ptr<Surface> TextureCache::Load(const std::string& filepath)
+{
+	std::string cachePath = filepath + CACHE_EXTENSION;
+
+	std::shared_ptr<Surface> texture = Map(cachePath, filepath);
+	if ( texture != nullptr )
+		return texture;
+
+	texture = std::make_shared<Surface>(filepath);
+
+	// couldn't decode the image, nothing worth caching
+	if ( texture->GetPixels() == nullptr )
+		return texture;
+
+	// textures are only sampled, so they are stored tiled
+	texture->GenerateMipMaps();
+	texture->SetLayout(Surface::LAYOUT_TILED);
+
+	Write(*texture, cachePath, filepath);
+
+	return texture;
+}
+
+std::shared_ptr<Surface> TextureCache::Map(const std::string& cachePath, const std::string& sourcePath)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(cachePath, true);
+	if ( !file->IsOpen() || file->GetSize() < sizeof(TextureHeader) )
+		return nullptr;
+
+	TextureHeader header;
+	memcpy(&header, file->GetData(), sizeof(header));
+
+	long long sourceSize, sourceTime;
+	if ( memcmp(header.magic, "RTTX", 4) != 0 || header.version != TEXTURE_CACHE_VERSION || header.numLevels == 0 ||
+		(header.layout != Surface::LAYOUT_LINEAR && header.layout != Surface::LAYOUT_TILED) ||
+		!MappedFile::GetFileStamp(sourcePath, sourceSize, sourceTime) || header.sourceSize != sourceSize || header.sourceTime != sourceTime ) {
+		return nullptr;
+	}
+
+	if ( (file->GetSize() - sizeof(header)) / sizeof(TextureLevel) < header.numLevels )
+		return nullptr;
+
+	std::vector<TextureLevel> levels(header.numLevels);
+	memcpy(levels.data(), file->GetData() + sizeof(header), levels.size() * sizeof(TextureLevel));
+
+	for ( const TextureLevel& level : levels ) {
+
+		unsigned long long levelWidth = level.width, levelHeight = level.height;
+
+		// tiled levels are padded to whole tiles
+		if ( header.layout == Surface::LAYOUT_TILED ) {
+			levelWidth = (levelWidth + Surface::TILE_SIZE - 1) / Surface::TILE_SIZE * Surface::TILE_SIZE;
+			levelHeight = (levelHeight + Surface::TILE_SIZE - 1) / Surface::TILE_SIZE * Surface::TILE_SIZE;
+		}
+
+		unsigned long long levelSize = levelWidth * levelHeight * sizeof(int);
+
+		if ( level.width == 0 || level.height == 0 || level.offset % TEXTURE_CACHE_ALIGNMENT != 0 ||
+			level.offset > file->GetSize() || file->GetSize() - level.offset < levelSize ) {
+			return nullptr;
+		}
+	}
+
+	// every level keeps the mapping alive, the chain is linked the
+	// same way GenerateMipMaps links it
+	std::shared_ptr<Surface> texture;
+	Surface* previous = nullptr;
+
+	for ( const TextureLevel& level : levels ) {
+
+		int* pPixels = (int*)(file->GetWritableData() + level.offset);
+		Surface* surface = new Surface(level.width, level.height, pPixels, file);
+		surface->SetColorMasks(header.aMask, header.rMask, header.gMask, header.bMask);
+		surface->layout = header.layout;
+
+		if ( previous == nullptr )
+			texture.reset(surface);
+		else
+			previous->mipMap = surface;
+
+		previous = surface;
+	}
+
+	return texture;
+}
+
+bool TextureCache::Write(const Surface& surface, const std::string& cachePath, const std::string& sourcePath)
+{
+	TextureHeader header = {};
+	memcpy(header.magic, "RTTX", 4);
+	header.version = TEXTURE_CACHE_VERSION;
+	header.rMask = surface.GetRMask();
+	header.gMask = surface.GetGMask();
+	header.bMask = surface.GetBMask();
+	header.aMask = surface.GetAMask();
+	header.layout = surface.GetLayout();
+
+	if ( !MappedFile::GetFileStamp(sourcePath, header.sourceSize, header.sourceTime) )
+		return false;
+
+	std::vector<const Surface*> chain;
+	for ( const Surface* level = &surface; level != nullptr; level = level->mipMap ) {
+
+		if ( level->GetLayout() != surface.GetLayout() )
+			return false;
+
+		chain.push_back(level);
+	}
+
+	header.numLevels = (unsigned int)chain.size();
+
+	// levels are laid out one after the other after the level table
+	std::vector<TextureLevel> levels(chain.size());
+	unsigned long long offset = sizeof(header) + levels.size() * sizeof(TextureLevel);
+
+	for ( size_t i = 0; i < chain.size(); ++i ) {
+
+		offset = (offset + TEXTURE_CACHE_ALIGNMENT - 1) / TEXTURE_CACHE_ALIGNMENT * TEXTURE_CACHE_ALIGNMENT;
+
+		levels[i].width = chain[i]->GetWidth();
+		levels[i].height = chain[i]->GetHeight();
+		levels[i].offset = offset;
+
+		offset += chain[i]->GetBufferSize();
+	}
+
+	// other processes may have the old cache mapped, it is replaced once the new one is complete
+	bool written = MappedFile::WriteFileAtomically(cachePath, [&](std::ofstream& file) {
+
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)levels.data(), levels.size() * sizeof(TextureLevel));
+
+		static const char zeros[TEXTURE_CACHE_ALIGNMENT] = {};
+
+		for ( size_t i = 0; i < chain.size(); ++i ) {
+
+			unsigned long long position = file.tellp();
+			file.write(zeros, levels[i].offset - position);
+			file.write((const char*)chain[i]->GetPixels(), chain[i]->GetBufferSize());
+		}
+
+	});
+
+	if ( !written )
+		std::cout << "Could not write texture cache " << cachePath << std::endl;
+
+	return written;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "Surface.h"
+#include <memory>
+#include <string>
+
+// Decoded textures with their whole mip chain, stored in a file next to
+// the image. Loading a cached texture only maps the file, nothing is
+// decoded or filtered, and pages are read as sampling touches them.
+// The mapping is copy on write, so the surfaces can still be edited.
+// Cached surfaces are stored in the tiled layout, see Surface::SetLayout.
+
+class TextureCache
+{
+private:
+	static std::shared_ptr<Surface> Map(const std::string& cachePath, const std::string& sourcePath);
+
+public:
+	// cached textures are stored at the image path with this appended
+	static const char* const CACHE_EXTENSION;
+
+	// maps the image's cache if it is up to date, otherwise decodes
+	// the image, builds its mip chain and writes a new cache
+	static std::shared_ptr<Surface> Load(const std::string& filepath);
+
+	// writes a surface and all of its mip maps, sourcePath is the
+	// image it was made from
+	static bool Write(const Surface& surface, const std::string& cachePath, const std::string& sourcePath);
+
+};
@@ -0,0 +1,129 @@
+#include "ThreadPool.h"
+#include <atomic>
+#include <algorithm>
+
+ThreadPool& ThreadPool::Global()
+{
+	static ThreadPool pool(std::max((int)std::thread::hardware_concurrency() - 1, 1));
+	return pool;
+}
+
+ThreadPool::ThreadPool(int nThreads)
+{
+	for ( int i = 0; i < nThreads; ++i )
+		threads.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	taskAvailable.notify_all();
+
+	for ( std::thread& thread : threads )
+		thread.join();
+}
+
+int ThreadPool::NumThreads() const
+{
+	return (int)threads.size();
+}
+
+void ThreadPool::WorkerLoop()
+{
+	while ( true ) {
+
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			taskAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+
+			// finish what was queued before shutting down
+			if ( tasks.empty() )
+				return;
+
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+void ThreadPool::Enqueue(std::function<void()>&& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	taskAvailable.notify_one();
+}
+
+void ThreadPool::ParallelFor(int count, int grainSize, const std::function<void(int, int)>& body)
+{
+	if ( count <= 0 )
+		return;
+
+	// the ranges never go past count, so they fit back into ints
+	ParallelFor((size_t)count, (size_t)std::max(grainSize, 1), [&body](size_t begin, size_t end) {
+		body((int)begin, (int)end);
+	});
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body)
+{
+	if ( count == 0 )
+		return;
+
+	grainSize = std::max(grainSize, (size_t)1);
+	size_t numChunks = (count + grainSize - 1) / grainSize;
+
+	if ( numChunks == 1 || threads.empty() ) {
+		body(0, count);
+		return;
+	}
+
+	// helpers can start after the loop is over, so everything
+	// they touch lives as long as the last of them
+	struct Loop {
+		std::atomic<size_t> nextChunk;
+		std::atomic<size_t> chunksDone;
+		std::mutex mutex;
+		std::condition_variable finished;
+	};
+
+	auto loop = std::make_shared<Loop>();
+	loop->nextChunk = 0;
+	loop->chunksDone = 0;
+
+	const std::function<void(size_t, size_t)>* pBody = &body;
+
+	// body is only used after claiming a chunk, and
+	// the caller doesn't return until every chunk is done
+	auto work = [loop, pBody, count, grainSize, numChunks]() {
+
+		size_t chunk;
+		while ( (chunk = loop->nextChunk.fetch_add(1)) < numChunks ) {
+
+			size_t begin = chunk * grainSize;
+			(*pBody)(begin, std::min(begin + grainSize, count));
+
+			if ( loop->chunksDone.fetch_add(1) + 1 == numChunks ) {
+				std::lock_guard<std::mutex> lock(loop->mutex);
+				loop->finished.notify_all();
+			}
+		}
+	};
+
+	size_t numHelpers = std::min(numChunks - 1, threads.size());
+	for ( size_t i = 0; i < numHelpers; ++i )
+		Enqueue(work);
+
+	work();
+
+	std::unique_lock<std::mutex> lock(loop->mutex);
+	loop->finished.wait(lock, [&]() { return loop->chunksDone == numChunks; });
+}
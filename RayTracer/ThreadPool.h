@@ -0,0 +1,59 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#include <deque>
+
+// A fixed set of worker threads for loading and preprocessing work.
+// The renderer keeps its own threads, this is for everything around it.
+
+class ThreadPool
+{
+private:
+	std::vector<std::thread> threads;
+
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable taskAvailable;
+	bool stopping = false;
+
+	void WorkerLoop();
+	void Enqueue(std::function<void()>&& task);
+
+public:
+	// one thread less than the hardware has, the caller
+	// of ParallelFor works on the loop as well
+	static ThreadPool& Global();
+
+	ThreadPool(int nThreads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int NumThreads() const;
+
+	template <class Function>
+	auto Submit(Function&& function) -> std::future<decltype(function())>
+	{
+		typedef decltype(function()) Result;
+
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+		std::future<Result> future = task->get_future();
+
+		Enqueue([task]() { (*task)(); });
+		return future;
+	}
+
+	// calls body(begin, end) on ranges covering [0, count), each at least
+	// grainSize long. The calling thread takes ranges too and returns once
+	// all of them are done, so this can be called from inside a task.
+	// Loops that can run past INT_MAX pass both sizes as size_t
+	void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body);
+	void ParallelFor(int count, int grainSize, const std::function<void(int, int)>& body);
+
+};
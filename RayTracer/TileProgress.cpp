@@ -0,0 +1,160 @@
+#include "TileProgress.h"
+#include <algorithm>
+#include <chrono>
+#include <immintrin.h>
+
+TileProgress::TileProgress(int width, int height)
+	:
+	width(width), height(height),
+	tilesX((width + TILE_SIZE - 1) / TILE_SIZE), tilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+	dirty(new std::atomic<bool>[tilesX * tilesY]), written(new std::atomic<unsigned int>[tilesX * tilesY * TILE_SIZE]),
+	remaining(new std::atomic<int>[tilesX * tilesY]),
+	finished(tilesX * tilesY), pending(false)
+{
+	Reset();
+}
+
+void TileProgress::Reset()
+{
+	for ( int t = 0; t < tilesX * tilesY; ++t ) {
+
+		int x, y, tileWidth, tileHeight;
+		GetTileRect(t, x, y, tileWidth, tileHeight);
+
+		dirty[t] = false;
+		remaining[t] = tileWidth * tileHeight;
+
+		for ( int row = 0; row < TILE_SIZE; ++row )
+			written[t * TILE_SIZE + row] = 0;
+	}
+
+	finished.Clear();
+	pending = false;
+}
+
+bool TileProgress::IsUnmarked() const
+{
+	for ( int t = 0; t < tilesX * tilesY; ++t ) {
+
+		int x, y, tileWidth, tileHeight;
+		GetTileRect(t, x, y, tileWidth, tileHeight);
+
+		if ( remaining[t] != tileWidth * tileHeight )
+			return false;
+	}
+
+	return true;
+}
+
+int TileProgress::GetWidth() const
+{
+	return width;
+}
+
+int TileProgress::GetHeight() const
+{
+	return height;
+}
+
+int TileProgress::NumTiles() const
+{
+	return tilesX * tilesY;
+}
+
+int TileProgress::TileAt(int x, int y) const
+{
+	return (y / TILE_SIZE) * tilesX + x / TILE_SIZE;
+}
+
+void TileProgress::GetTileRect(int tile, int& outX, int& outY, int& outWidth, int& outHeight) const
+{
+	outX = (tile % tilesX) * TILE_SIZE;
+	outY = (tile / tilesX) * TILE_SIZE;
+	outWidth = std::min(TILE_SIZE, width - outX);
+	outHeight = std::min(TILE_SIZE, height - outY);
+}
+
+void TileProgress::MarkPixels(int tile, const unsigned int rows[TILE_SIZE])
+{
+	// only pixels that weren't marked before are taken off the count, so
+	// the thread that marks the last unwritten pixel of a tile queues it
+	int newPixels = 0;
+
+	for ( int row = 0; row < TILE_SIZE; ++row ) {
+
+		if ( rows[row] == 0 )
+			continue;
+
+		unsigned int before = written[tile * TILE_SIZE + row].fetch_or(rows[row]);
+		newPixels += _mm_popcnt_u32(rows[row] & ~before);
+	}
+
+	if ( newPixels > 0 && remaining[tile].fetch_sub(newPixels) == newPixels )
+		finished.Push(tile);
+
+	// a tile that is already marked will be taken with
+	// these pixels as well, nobody has to be woken
+	if ( dirty[tile].exchange(true) )
+		return;
+
+	if ( !pending.exchange(true) ) {
+		std::lock_guard<std::mutex> lock(mutex);
+		marked.notify_all();
+	}
+}
+
+void TileProgress::MarkRect(int x, int y, int width, int height)
+{
+	if ( width <= 0 || height <= 0 )
+		return;
+
+	int firstX = x / TILE_SIZE;
+	int firstY = y / TILE_SIZE;
+	int lastX = (x + width - 1) / TILE_SIZE;
+	int lastY = (y + height - 1) / TILE_SIZE;
+
+	for ( int ty = firstY; ty <= lastY; ++ty ) {
+		for ( int tx = firstX; tx <= lastX; ++tx ) {
+
+			// the part of the rect inside this tile, relative to the tile
+			int left = std::max(x, tx * TILE_SIZE) - tx * TILE_SIZE;
+			int right = std::min(x + width, (tx + 1) * TILE_SIZE) - tx * TILE_SIZE;
+			int top = std::max(y, ty * TILE_SIZE) - ty * TILE_SIZE;
+			int bottom = std::min(y + height, (ty + 1) * TILE_SIZE) - ty * TILE_SIZE;
+
+			// bits left up to right, shifted in 64 bits so a full row doesn't overflow
+			unsigned int columns = (unsigned int)(((1ull << right) - 1) & ~((1ull << left) - 1));
+
+			unsigned int rows[TILE_SIZE] = {};
+			for ( int row = top; row < bottom; ++row )
+				rows[row] = columns;
+
+			MarkPixels(ty * tilesX + tx, rows);
+		}
+	}
+}
+
+bool TileProgress::WaitForTiles(std::vector<int>& outTiles, int timeoutMilliseconds)
+{
+	outTiles.clear();
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		marked.wait_for(lock, std::chrono::milliseconds(timeoutMilliseconds), [this]() { return pending.load(); });
+	}
+
+	// cleared before looking at the tiles, a tile marked
+	// after it was looked at sets this again and wakes the next wait
+	pending = false;
+
+	for ( int t = 0; t < tilesX * tilesY; ++t )
+		if ( dirty[t].exchange(false) )
+			outTiles.push_back(t);
+
+	return !outTiles.empty();
+}
+
+bool TileProgress::PopFinishedTile(int& outTile)
+{
+	return finished.TryPop(outTile);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include "TileQueue.h"
+
+// Tracks which tiles of an image changed since they were last taken.
+// Render threads mark tiles once they have written into them, and a
+// display thread sleeps until something is marked, then takes the
+// marked tiles and uploads only those.
+//
+// It also keeps which pixels of each tile were written, and tiles that
+// have all of their pixels are queued as finished. A consumer can
+// show, encode or send those while the rest of the frame renders.
+
+class TileProgress
+{
+public:
+	// a row of a tile is one bit per pixel in an unsigned int
+	static constexpr int TILE_SIZE = 32;
+
+private:
+	int width;
+	int height;
+	int tilesX;
+	int tilesY;
+
+	std::unique_ptr<std::atomic<bool>[]> dirty;
+
+	// the pixels written so far, TILE_SIZE rows for each tile.
+	// A pixel written twice is only counted once
+	std::unique_ptr<std::atomic<unsigned int>[]> written;
+	std::unique_ptr<std::atomic<int>[]> remaining;
+	TileQueue finished;
+
+	// set by the first mark after the tiles were taken,
+	// so only that mark has to wake the waiting thread
+	std::atomic<bool> pending;
+
+	std::mutex mutex;
+	std::condition_variable marked;
+
+public:
+	TileProgress(int width, int height);
+
+	TileProgress(const TileProgress&) = delete;
+	TileProgress& operator=(const TileProgress&) = delete;
+
+	int GetWidth() const;
+	int GetHeight() const;
+
+	int NumTiles() const;
+	int TileAt(int x, int y) const;
+
+	// tiles at the right and bottom edges can be smaller than TILE_SIZE
+	void GetTileRect(int tile, int& outX, int& outY, int& outWidth, int& outHeight) const;
+
+	// any thread can mark, the pixels have to be written before marking.
+	// Bit x of rows[y] is the pixel at x, y in the tile. A tile is
+	// finished once every one of its pixels was marked
+	void MarkPixels(int tile, const unsigned int rows[TILE_SIZE]);
+	void MarkRect(int x, int y, int width, int height);
+
+	// blocks until a tile is marked or the timeout passes, then moves the
+	// marked tiles into outTiles. Returns false if nothing was marked
+	bool WaitForTiles(std::vector<int>& outTiles, int timeoutMilliseconds);
+
+	// the tiles in the order they were finished, only one thread may take them
+	bool PopFinishedTile(int& outTile);
+
+	// starts a new frame, nothing may mark or take tiles while it runs
+	void Reset();
+
+	// true if no pixel was marked since the last Reset, any thread can call it
+	bool IsUnmarked() const;
+
+};
@@ -0,0 +1,71 @@
+#include "TileQueue.h"
+
+TileQueue::TileQueue(int numTiles)
+	:
+	nodes(new Node[numTiles])
+{
+	Clear();
+}
+
+void TileQueue::Clear()
+{
+	stub.next.store(nullptr, std::memory_order_relaxed);
+	head.store(&stub, std::memory_order_relaxed);
+	tail = &stub;
+}
+
+void TileQueue::PushNode(Node* node)
+{
+	node->next.store(nullptr, std::memory_order_relaxed);
+
+	// the node is the last one as soon as it is swapped in, the link from
+	// the one before it follows. Until then the consumer sees the queue end early
+	Node* previous = head.exchange(node, std::memory_order_acq_rel);
+	previous->next.store(node, std::memory_order_release);
+}
+
+void TileQueue::Push(int tile)
+{
+	PushNode(&nodes[tile]);
+}
+
+bool TileQueue::TryPop(int& outTile)
+{
+	Node* first = tail;
+	Node* next = first->next.load(std::memory_order_acquire);
+
+	// step over the stub, it isn't a tile
+	if ( first == &stub ) {
+
+		if ( next == nullptr )
+			return false;
+
+		tail = next;
+		first = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+
+	if ( next != nullptr ) {
+		tail = next;
+		outTile = (int)(first - nodes.get());
+		return true;
+	}
+
+	// first is the last node linked, if it isn't the head another
+	// thread is between its exchange and its link
+	if ( first != head.load(std::memory_order_acquire) )
+		return false;
+
+	// put the stub behind the last tile so that tile can be taken out
+	PushNode(&stub);
+
+	next = first->next.load(std::memory_order_acquire);
+
+	if ( next != nullptr ) {
+		tail = next;
+		outTile = (int)(first - nodes.get());
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <memory>
+
+// A lock-free queue of tile indices that any number of threads push
+// into and one thread pops from, Dmitry Vyukov's intrusive MPSC queue.
+// A push is one exchange and one store, so render threads never wait
+// on the consumer or each other.
+//
+// Every tile has its own node, so pushing never allocates, and a tile
+// can't be in the queue twice at the same time.
+
+class TileQueue
+{
+private:
+	struct Node {
+		std::atomic<Node*> next;
+	};
+
+	std::unique_ptr<Node[]> nodes;
+
+	// stays in the queue so it is never empty, which lets
+	// producers link onto the last node without checking
+	Node stub;
+
+	// the last node pushed, shared by the producers
+	alignas(64) std::atomic<Node*> head;
+
+	// the next node to pop, only the consumer touches it
+	alignas(64) Node* tail;
+
+	void PushNode(Node* node);
+
+public:
+	TileQueue(int numTiles);
+
+	TileQueue(const TileQueue&) = delete;
+	TileQueue& operator=(const TileQueue&) = delete;
+
+	// any thread, the tile must not be in the queue already
+	void Push(int tile);
+
+	// only one thread may pop. Returns false if the queue is empty, or
+	// if the only tile left is still being pushed, it shows up once it is
+	bool TryPop(int& outTile);
+
+	// empties the queue, nothing may push or pop while it runs
+	void Clear();
+
+};
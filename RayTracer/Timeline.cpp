@@ -0,0 +1,113 @@
+#include "Timeline.h"
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+
+Timeline::Scope::Scope(Timeline& timeline, int lane, const char* name)
+	:
+	timeline(timeline), lane(lane), name(name)
+{
+	start = timeline.IsEnabled() ? timeline.Now() : 0;
+}
+
+Timeline::Scope::~Scope()
+{
+	if ( timeline.IsEnabled() )
+		timeline.Record(lane, name, start, timeline.Now());
+}
+
+Timeline::Timeline()
+	:
+	enabled(false), epoch(std::chrono::steady_clock::now())
+{
+}
+
+void Timeline::Enable(bool enable, int numLanes)
+{
+	// lane 0 is the calling thread, the rest
+	// are for the other hardware threads
+	if ( numLanes <= 0 )
+		numLanes = std::max((int)std::thread::hardware_concurrency(), 1);
+
+	// allocating here keeps it off the recording path,
+	// the events recorded so far are kept
+	if ( enable && numLanes > this->numLanes ) {
+
+		std::unique_ptr<Event[]> newEvents(new Event[(size_t)numLanes * EVENTS_PER_LANE]);
+		std::unique_ptr<long long[]> newCounts(new long long[(size_t)numLanes * COUNT_STRIDE]());
+
+		for ( int i = 0; i < this->numLanes; ++i ) {
+			std::copy(&events[(size_t)i * EVENTS_PER_LANE], &events[(size_t)(i + 1) * EVENTS_PER_LANE], &newEvents[(size_t)i * EVENTS_PER_LANE]);
+			newCounts[i * COUNT_STRIDE] = counts[i * COUNT_STRIDE];
+		}
+
+		events = std::move(newEvents);
+		counts = std::move(newCounts);
+		this->numLanes = numLanes;
+	}
+
+	enabled.store(enable, std::memory_order_release);
+}
+
+bool Timeline::IsEnabled() const
+{
+	return enabled.load(std::memory_order_acquire);
+}
+
+int Timeline::NumLanes() const
+{
+	return numLanes;
+}
+
+void Timeline::Clear()
+{
+	for ( int i = 0; i < numLanes; ++i )
+		counts[i * COUNT_STRIDE] = 0;
+}
+
+void Timeline::ExportChromeTrace(const std::string& filename) const
+{
+	std::ofstream file(filename);
+
+	if ( !file ) {
+		std::cout << "Error opening " << filename << std::endl;
+		return;
+	}
+
+	// the trace format wants microseconds
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	bool first = true;
+
+	for ( int i = 0; i < numLanes; ++i ) {
+
+		long long count = counts[i * COUNT_STRIDE];
+		if ( count == 0 )
+			continue;
+
+		// name the lane so the viewer shows it as a thread
+		if ( !first )
+			file << ",";
+		first = false;
+
+		file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << i
+			<< ",\"args\":{\"name\":\"" << (i == 0 ? "Main" : "Worker " + std::to_string(i)) << "\"}}";
+
+		// only the newest events survive a full ring buffer
+		long long oldest = count > EVENTS_PER_LANE ? count - EVENTS_PER_LANE : 0;
+
+		for ( long long e = oldest; e < count; ++e ) {
+
+			const Event& event = events[(size_t)i * EVENTS_PER_LANE + e % EVENTS_PER_LANE];
+
+			file << ",{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << i
+				<< ",\"ts\":" << event.start / 1000.0
+				<< ",\"dur\":" << (event.end - event.start) / 1000.0 << "}";
+		}
+	}
+
+	file << "]}" << std::endl;
+}
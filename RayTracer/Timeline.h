@@ -0,0 +1,88 @@
+#pragma once
+#include <string>
+#include <chrono>
+#include <memory>
+#include <atomic>
+
+// Records timed events into a ring buffer per thread and exports
+// them in the Chrome trace event format, which can be opened in
+// chrome://tracing or the Perfetto trace viewer.
+
+class Timeline
+{
+public:
+
+	static constexpr int EVENTS_PER_LANE = 4096;
+
+	// records an event lasting from construction to destruction
+	class Scope {
+	private:
+		Timeline& timeline;
+		int lane;
+		const char* name;
+		long long start;
+
+	public:
+		Scope(Timeline& timeline, int lane, const char* name);
+		~Scope();
+	};
+
+private:
+
+	struct Event {
+		const char* name;
+		long long start;
+		long long end;
+	};
+
+	// the lanes' events one after the other, each lane is only
+	// ever written by one thread at a time
+	std::unique_ptr<Event[]> events;
+
+	// spaced a cache line apart, so that threads
+	// don't share lines with their neighbours
+	static constexpr int COUNT_STRIDE = 64 / sizeof(long long);
+	std::unique_ptr<long long[]> counts;
+
+	int numLanes = 0;
+	std::atomic<bool> enabled;
+
+	std::chrono::steady_clock::time_point epoch;
+
+public:
+
+	Timeline();
+
+	// the lanes are allocated by the first Enable, and again if more are
+	// asked for, 0 gives one per hardware thread. Events on lanes past the
+	// last are dropped. Must not be called while any thread is recording
+	// unless the lanes are already there
+	void Enable(bool enable, int numLanes = 0);
+	bool IsEnabled() const;
+	int NumLanes() const;
+
+	// nanoseconds since the timeline was created
+	inline long long Now() const {
+
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+
+	}
+
+	// name must be a string literal, only the pointer is stored
+	inline void Record(int lane, const char* name, long long start, long long end) {
+
+		// pairs with Enable, so the lanes are seen once it is
+		if ( !enabled.load(std::memory_order_acquire) || lane < 0 || lane >= numLanes )
+			return;
+
+		// when the buffer is full the oldest events are overwritten
+		long long& count = counts[lane * COUNT_STRIDE];
+		events[lane * EVENTS_PER_LANE + count++ % EVENTS_PER_LANE] = { name, start, end };
+
+	}
+
+	// must not be called while any thread is recording
+	void Clear();
+	void ExportChromeTrace(const std::string& filename) const;
+
+};
@@ -19,7 +19,7 @@ Window::Window(const char* title, int x, int y, int width, int height, int optio
 	lastHeight = height;
 }
 
-void Window::DrawSurface(const Surface& surface) {
+bool Window::PrepareTexture(const Surface& surface) {
 
 	if ( lastWidth != GetWidth() || lastHeight != GetHeight() ) {
 
@@ -29,39 +29,71 @@ void Window::DrawSurface(const Surface& surface) {
 		SDL_CALL(SDL_DestroyRenderer(pRenderer));
 		SDL_CALL(pRenderer = SDL_CreateRenderer(pWindow, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC));
 
+		// the texture went with the renderer
+		pTexture = nullptr;
+
 		lastWidth = GetWidth();
 		lastHeight = GetHeight();
 	}
 
-	SDL_Surface* pSurface;
-	
-	SDL_CALL(pSurface = SDL_CreateRGBSurfaceFrom(
-		(void*)surface.GetPixels(),
-		surface.GetWidth(),
-		surface.GetHeight(),
-		Surface::BPP,
-		surface.GetPitch(),
-		surface.GetRMask(),
-		surface.GetGMask(),
-		surface.GetBMask(),
-		surface.GetAMask()
-	));
-
-	SDL_Texture* texture;
-
-	SDL_CALL(texture = SDL_CreateTextureFromSurface(pRenderer, pSurface));
-	SDL_CALL(SDL_FreeSurface(pSurface));
+	Uint32 format = SDL_MasksToPixelFormatEnum(Surface::BPP, surface.GetRMask(), surface.GetGMask(), surface.GetBMask(), surface.GetAMask());
 
-	SDL_CALL(SDL_RenderClear(pRenderer));
-	SDL_CALL(SDL_RenderCopy(pRenderer, texture, NULL, NULL));
+	if ( pTexture != nullptr && textureWidth == surface.GetWidth() && textureHeight == surface.GetHeight() && textureFormat == format )
+		return false;
+
+	if ( pTexture != nullptr )
+		SDL_CALL(SDL_DestroyTexture(pTexture));
+
+	SDL_CALL(pTexture = SDL_CreateTexture(pRenderer, format, SDL_TEXTUREACCESS_STREAMING, surface.GetWidth(), surface.GetHeight()));
+
+	textureWidth = surface.GetWidth();
+	textureHeight = surface.GetHeight();
+	textureFormat = format;
+
+	return true;
 
+}
+
+void Window::Present() {
+
+	SDL_CALL(SDL_RenderClear(pRenderer));
+	SDL_CALL(SDL_RenderCopy(pRenderer, pTexture, NULL, NULL));
 	SDL_CALL(SDL_RenderPresent(pRenderer));
-	SDL_CALL(SDL_DestroyTexture(texture));
+
+}
+
+void Window::DrawSurface(const Surface& surface) {
+
+	PrepareTexture(surface);
+
+	SDL_CALL(SDL_UpdateTexture(pTexture, NULL, surface.GetPixels(), surface.GetPitch()));
+	Present();
+
+}
+
+void Window::DrawSurface(const Surface& surface, const SDL_Rect* dirtyRects, int numRects) {
+
+	if ( PrepareTexture(surface) ) {
+		DrawSurface(surface);
+		return;
+	}
+
+	for ( int i = 0; i < numRects; ++i ) {
+
+		const SDL_Rect& rect = dirtyRects[i];
+		const int* pixels = surface.GetPixels() + rect.y * surface.GetWidth() + rect.x;
+
+		SDL_CALL(SDL_UpdateTexture(pTexture, &rect, pixels, surface.GetPitch()));
+	}
+
+	Present();
 
 }
 
 Window::~Window() {
 
+	if ( pTexture != nullptr )
+		SDL_CALL(SDL_DestroyTexture(pTexture));
 	SDL_CALL(SDL_DestroyRenderer(pRenderer));
 	SDL_CALL(SDL_DestroyWindow(pWindow));
 
@@ -10,15 +10,30 @@ private:
 	SDL_Window* pWindow = nullptr;
 	SDL_Renderer* pRenderer = nullptr;
 
+	// kept between draws and updated where the surface changed
+	SDL_Texture* pTexture = nullptr;
+	int textureWidth = 0;
+	int textureHeight = 0;
+	Uint32 textureFormat = 0;
+
 	mutable int lastWidth;
 	mutable int lastHeight;
 
+	// returns true if the texture is new and all of it has to be uploaded
+	bool PrepareTexture(const Surface& surface);
+	void Present();
+
 public:
 	Window(const char* title, int x, int y, int width, int height, int options);
 	~Window();
 
+	// the surface has to be in the linear layout
 	void DrawSurface(const Surface& surface);
 
+	// uploads only the rects of the surface that changed since the last
+	// draw, the rest of the texture still has what was drawn before
+	void DrawSurface(const Surface& surface, const SDL_Rect* dirtyRects, int numRects);
+
 	int GetWidth() const;
 	int GetHeight() const;
 